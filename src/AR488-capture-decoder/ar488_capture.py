@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""
+AR488 bus capture decoder
+
+Reads the binary frames sent by the AR488 in capture mode (++capture 1)
+from a serial port or a file of saved output and prints a readable trace
+of the bus traffic.
+
+Frame:  0xA5 0x5A <count> <count x 4-byte records> <XOR of record bytes>
+        (a count of zero marks the end of the capture)
+Record: <flags> <delta lo> <delta hi> <data>
+        flags bit 0 = ATN, bit 1 = EOI, bit 2 = SRQ,
+        bit 6 = delta in milliseconds rather than microseconds
+
+Usage:
+    ar488_capture.py /dev/ttyUSB0 [--baud 115200] [--start]
+    ar488_capture.py --file capture.bin
+"""
+
+import argparse
+import sys
+
+SYNC1 = 0xA5
+SYNC2 = 0x5A
+REC_SIZE = 4
+
+CAP_ATN = 0x01
+CAP_EOI = 0x02
+CAP_SRQ = 0x04
+CAP_MSEC = 0x40
+
+UNIVERSAL = {
+    0x01: "GTL",
+    0x04: "SDC",
+    0x05: "PPC",
+    0x08: "GET",
+    0x09: "TCT",
+    0x11: "LLO",
+    0x14: "DCL",
+    0x15: "PPU",
+    0x18: "SPE",
+    0x19: "SPD",
+}
+
+
+def decode_command(db):
+    """Return the mnemonic for a byte sent with ATN asserted."""
+    db &= 0x7F
+    if db == 0x3F:
+        return "UNL"
+    if db == 0x5F:
+        return "UNT"
+    if 0x20 <= db <= 0x3E:
+        return "LAD %d" % (db - 0x20)
+    if 0x40 <= db <= 0x5E:
+        return "TAD %d" % (db - 0x40)
+    if 0x60 <= db <= 0x7E:
+        return "SAD %d" % (db - 0x60)
+    return UNIVERSAL.get(db, "CMD 0x%02X" % db)
+
+
+def decode_data(db):
+    """Return a printable form of a data byte."""
+    if 0x20 <= db < 0x7F:
+        return "'%s'" % chr(db)
+    names = {0x0A: "LF", 0x0D: "CR", 0x09: "TAB"}
+    return names.get(db, "")
+
+
+def frames(read):
+    """Yield the records of each valid frame read with read(n)."""
+    state = 0
+    while True:
+        b = read(1)
+        if not b:
+            return
+        b = b[0]
+        if state == 0:
+            state = 1 if b == SYNC1 else 0
+            continue
+        if b != SYNC2:
+            state = 1 if b == SYNC1 else 0
+            continue
+        state = 0
+        count = read(1)
+        if not count:
+            return
+        if count[0] == 0:
+            # End of capture
+            read(1)
+            return
+        payload = read(count[0] * REC_SIZE + 1)
+        if len(payload) < count[0] * REC_SIZE + 1:
+            return
+        chk = 0
+        for x in payload[:-1]:
+            chk ^= x
+        if chk != payload[-1]:
+            print("# bad frame checksum, %d records dropped" % count[0])
+            continue
+        for i in range(count[0]):
+            yield payload[i * REC_SIZE:(i + 1) * REC_SIZE]
+
+
+def trace(read, out):
+    t_us = 0
+    for rec in frames(read):
+        flags, dlo, dhi, db = rec
+        delta = dlo | (dhi << 8)
+        if flags & CAP_MSEC:
+            delta *= 1000
+        t_us += delta
+        lnst = ("A" if flags & CAP_ATN else "-") + \
+                ("E" if flags & CAP_EOI else "-") + \
+                ("S" if flags & CAP_SRQ else "-")
+        if flags & CAP_ATN:
+            text = decode_command(db)
+        else:
+            text = decode_data(db)
+        out.write("%12.6f  +%-9d %s  %02X  %s\n" %
+                  (t_us / 1e6, delta, lnst, db, text))
+        out.flush()
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Decode AR488 bus capture frames")
+    ap.add_argument("port", nargs="?", help="serial port of the AR488")
+    ap.add_argument("--baud", type=int, default=115200, help="serial baud rate")
+    ap.add_argument("--file", help="read saved capture output from a file")
+    ap.add_argument("--start", action="store_true",
+                    help="send ++mode 0 and ++capture 1 before reading")
+    args = ap.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            trace(f.read, sys.stdout)
+        return
+
+    if not args.port:
+        ap.error("a serial port or --file is required")
+
+    import serial  # pyserial
+    with serial.Serial(args.port, args.baud, timeout=None) as port:
+        if args.start:
+            port.write(b"++mode 0\r++capture 1\r")
+        try:
+            trace(port.read, sys.stdout)
+        except KeyboardInterrupt:
+            if args.start:
+                port.write(b"++capture 0\r")
+
+
+if __name__ == "__main__":
+    main()
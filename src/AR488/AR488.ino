@@ -12,6 +12,7 @@
 #include "AR488_GPIBbus.h"
 #include "AR488_ComPorts.h"
 #include "AR488_Eeprom.h"
+#include "AR488_Capture.h"
 
 
 /***** FWVER "AR488 GPIB controller, ver. 0.53.23 (JW), 18/07/2025" *****/
@@ -224,7 +225,7 @@ static const char cmdHelpPrologix[] PROGMEM = {
   "ifc:\tAssert IFC signal for 150 miscoseconds - make AR488 controller in charge\n"
   "llo:\tLocal lockout - disable front panel operation on instrument\n"
   "loc:\tEnable front panel operation on instrument\n"
-  "lon:\tPut controller in listen-only mode (listen to all traffic)\n"
+  "lon:\tPut controller in listen-only mode (listen to all traffic) - see also: 'lon 1 hpgl'; 'lon 1 page'\n"
   "mode:\tSet the interface mode (1=controller/0=device)\n"
   "read:\tRead data from instrument\n"
   "read_tmo_ms:\tRead timeout specified between 1 - 3000 milliseconds\n"
@@ -233,7 +234,7 @@ static const char cmdHelpPrologix[] PROGMEM = {
   "spoll:\tSerial poll the addressed host or all instruments\n"
   "srq:\tReturn status of srq signal (1-srq asserted/0-srq not asserted)\n"
   "status:\tSet the status byte to be returned on being polled (bit 6 = RQS, i.e SRQ asserted)\n"
-  "trg:\tSend trigger to selected devices (up to 15 addresses)\n"
+  "trg:\tSend trigger to selected devices (up to 15 addresses, triggered together)\n"
   "ver:\tDisplay firmware version\n"
 };
 
@@ -241,6 +242,7 @@ static const char cmdHelpPrologix[] PROGMEM = {
 static const char cmdHelpExtended[] PROGMEM = {
   "/nExtended custom commands:"
   "aspoll:\tSerial poll all instruments (alias: ++spoll all)\n"
+  "capture:\tEnable/Disable binary bus capture in device mode (if compiled) - see also: 'capture trig'; 'capture stop'; 'capture filter'; 'capture pre'\n"
   "dcl:\tSend unaddressed (all) device clear  [power on reset] (is the rst?)\n"
   "default:\tSet configuration to controller default settings\n"
   "id:\tShow interface ID information - see also: 'id name'; 'id serial'; 'id verstr'\n"
@@ -248,21 +250,27 @@ static const char cmdHelpExtended[] PROGMEM = {
   "id serial:\tShow/Set the serial number of the interface\n"
   "id verstr:\tShow/Set the version string sent in reply to ++ver e.g. \"GPIB-USB\"). Max 47 chars, excess truncated.\n"
   "idn:\tEnable/Disable reply to *idn? (disabled by default)\n"
+  "inv:\tShow instrument inventory (if compiled) - see also: 'inv refresh'; 'inv clear'; 'inv addr'\n"
   "macro:\tRun a macro (if macro support is compiled)\n"
-  "fndl:\tFind listners\n"
+  "fndl:\tFind listners - see also: 'fndl all'; 'fndl nosec'\n"
+  "msend:\tSend data to several listeners at once, e.g. ++msend 5 7,2 9:data\n"
   "ppoll:\tConduct a parallel poll\n"
   "ren:\tAssert or Unassert the REN signal\n"
   "repeat:\tRepeat a given command and return result\n"
+  "resp:\tDevice mode query/response table (if compiled) - see also: 'resp add query|response'; 'resp del'; 'resp clear'; 'resp save'; 'resp stats'\n"
   "secread:\tRead from a secondary address\n"
   "secsend:\tSend data or command to a secondary address\n"
   "setvstr:\tDEPRECATED - see id verstr\n"
   "srqauto:\tAutomatically conduct serial poll when SRQ is asserted\n"
+  "subdev:\tEnable sub-devices at secondary addresses in device mode (if compiled) - see also: 'subdev none'; 'subdev stat'\n"
+  "talkq:\tQueue responses to send when addressed to talk (if compiled) - see also: 'talkq add'; 'talkq sub'; 'talkq clear'\n"
   "tct:\tSignal remote device to take control\n"
-  "ton:\tPut controller in talk-only mode (send data only)\n"
+  "ton:\tPut controller in talk-only mode (send data only) - see also: 'ton 1 eoi'; 'ton 1 idle'\n"
   "unl:\tUnlisten the GPIB bus\n"
   "unt:\tUntalk the GPIB bus"
   "verbose:\tVerbose (human readable) mode\n"
   "xdiag:\tBus diagnostics (see the doc)\n"
+  "xfer:\tTransfer data from a talker to listeners with the controller as an acceptor, e.g. ++xfer 7 5 [mon]\n"
 };
 
 
@@ -311,6 +319,8 @@ bool isQuery = false;               // Direct instrument command is a query
 uint8_t endByte = 0;                // Termination character
 bool isProm = false;                // Promiscuous mode flag
 bool isSpoll = false;               // Serial poll flag
+bool devLads = false;               // Device addressed to listen (LADS)
+bool devTads = false;               // Device addressed to talk (TADS)
 
 // Escaped character flag
 bool isEsc = false;           // Charcter escaped
@@ -318,9 +328,22 @@ bool isPlusEscaped = false;   // Plus escaped
 
 // Read only mode flag
 bool isRO = false;
+uint8_t lonSplit = 0;   // Split records: 1 = HP-GL ';', 2 = form feed
+static const uint8_t LONBSIZE = 64;
+static const uint16_t LONIDLE = 500;  // Bus idle time before sending to host (us)
 
 // Talk only mode flag
 uint8_t isTO = 0;
+uint8_t tonEoi = 0;     // Assert EOI: 1 = on terminator or end of line, 2 = when idle
+static const uint8_t TONBSIZE = 64;
+static const uint16_t TONIDLE = 20;   // Serial idle time before EOI is sent (ms)
+
+// Bus capture mode flag
+#ifdef USE_CAPTURE
+bool isCapt = false;
+GPIBcapture gpibCapture;
+static const uint16_t CAPIDLE = 500;  // Bus idle time before sending to host (us)
+#endif
 
 // Data send mode flags
 bool dataBufferFull = false;    // Flag when parse buffer is full
@@ -334,6 +357,40 @@ uint8_t runMacro = 0;
 // Send response to *idn?
 bool sendIdn = false;
 
+// Device mode talker output queue (frames of [length][tag][data])
+#ifdef DEVICE_TALK_QUEUE
+#define TQ_PRIMARY 0xFF
+uint8_t talkQ[TALKQ_SIZE];
+uint8_t tqUsed = 0;     // Bytes in use
+uint8_t tqFrames = 0;   // Number of frames queued
+#endif
+
+// Device mode sub-devices
+#ifdef DEVICE_SUBADDR
+uint32_t subMask = 0;   // Enabled sub-devices (secondary addresses 0-30)
+uint8_t subStat[31];    // Sub-device status bytes
+uint8_t devSub = 0xFF;  // Sub-device currently addressed (0xFF = none)
+#endif
+
+// Device mode query/response table (entries of [qlen][query][rlen][response])
+#ifdef DEVICE_RESP_TABLE
+uint8_t respTbl[RESP_TABLE_SIZE];
+uint16_t respHits = 0;
+uint16_t respMisses = 0;
+#endif
+
+// Instrument inventory
+#ifdef USE_INVENTORY
+struct invRec {
+  uint8_t pri;                    // Primary address
+  uint8_t sec;                    // Secondary address (0xFF = none)
+  bool stale;                     // Reply may be out of date
+  char idn[INVENTORY_IDN_LEN];    // Reply to *IDN?
+};
+invRec inventory[INVENTORY_SIZE];
+uint8_t invCnt = 0;
+#endif
+
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** COMMON VARIABLES SECTION *****/
 /************************************/
@@ -465,6 +522,10 @@ void setup() {
 //DB_RAW_PRINTLN(F("EEPROM data set to default."));
     }
   }
+#ifdef DEVICE_RESP_TABLE
+  // Load saved query/response table (empty if none or not valid)
+  if (!epReadArea(EERESP, respTbl, RESP_TABLE_SIZE)) memset(respTbl, 0, RESP_TABLE_SIZE);
+#endif
 #endif
 
   // SN7516x IC support
@@ -612,12 +673,19 @@ if (lnRdy>0){
 
   // Device mode:
   if (gpibBus.isController()==false) {
+    // IFC returns the device to the unaddressed state
+    if (gpibBus.isAsserted(IFC_PIN)) devUnaddress();
+#ifdef USE_CAPTURE
+    if (isCapt) {
+      captureMode();
+    }else
+#endif
     if (isTO>0) {
 //      if (lnRdy == 2) sendToInstrument(pBuf, pbPtr);
       tonMode();
     }else if (isRO) {
       lonMode();
-    }else if (gpibBus.isAsserted(ATN_PIN)) {
+    }else if (gpibBus.isAtnPending() || gpibBus.isAsserted(ATN_PIN)) {
       attnRequired();
     }else if (gpibBus.isDeviceAddressedToListen()) {
       device_listen_h();
@@ -660,6 +728,7 @@ if (lnRdy>0){
 void initDevice() {
   gpibBus.stop();
   gpibBus.startDeviceMode();
+  devUnaddress();
 }
 
 
@@ -903,6 +972,9 @@ static cmdRec cmdHidx [] = {
   { "addr",        3, addr_h      }, 
   { "allspoll",    2, (void(*)(char*)) aspoll_h  },
   { "auto",        2, amode_h     },
+#ifdef USE_CAPTURE
+  { "capture",     1, capt_h      },
+#endif
   { "clr",         2, (void(*)(char*)) clr_h     },
   { "dcl",         2, (void(*)(char*)) dcl_h     },
   { "default",     3, default_h   },
@@ -917,17 +989,24 @@ static cmdRec cmdHidx [] = {
   { "ifc",         2, (void(*)(char*)) ifc_h     },
   { "id",          3, id_h        },
   { "idn",         3, idn_h       },
+#ifdef USE_INVENTORY
+  { "inv",         2, inv_h       },
+#endif
   { "llo",         2, llo_h       },
   { "loc",         2, loc_h       },
   { "lon",         1, lon_h       },
   { "macro",       2, macro_h     },
   { "mode" ,       3, cmode_h     },
+  { "msend",       2, msend_h     },
   { "ppoll",       2, (void(*)(char*)) ppoll_h   },
   { "prom",        1, prom_h      },
   { "read",        2, read_h      },
   { "read_tmo_ms", 2, rtmo_h      },
   { "ren",         2, ren_h       },
   { "repeat",      2, repeat_h    },
+#ifdef DEVICE_RESP_TABLE
+  { "resp",        1, resp_h      },
+#endif
   { "rst",         3, (void(*)(char*)) rst_h     },
   { "trg",         2, trg_h       },
   { "savecfg",     3, (void(*)(char*)) save_h    },
@@ -937,13 +1016,20 @@ static cmdRec cmdHidx [] = {
   { "srq",         2, (void(*)(char*)) srq_h     },
   { "srqauto",     2, srqa_h      },
   { "status",      1, stat_h      },
+#ifdef DEVICE_SUBADDR
+  { "subdev",      1, subdev_h    },
+#endif
   { "tct",         2, tct_h       },
+#ifdef DEVICE_TALK_QUEUE
+  { "talkq",       1, talkq_h     },
+#endif
   { "ton",         1, ton_h       },
   { "unl",         2, (void(*)(char*)) unlisten_h  },
   { "unt",         2, (void(*)(char*)) untalk_h    },
   { "ver",         3, ver_h       },
   { "verbose",     3, (void(*)(char*)) verb_h    },
-  { "xdiag",       3, xdiag_h     }
+  { "xdiag",       3, xdiag_h     },
+  { "xfer",        2, xfer_h      }
 };
 
 
@@ -1356,6 +1442,7 @@ void cmode_h(char *params) {
     switch (val) {
       case 0:
         gpibBus.startDeviceMode();
+        devUnaddress();
         break;
       case 1:
         gpibBus.startControllerMode();
@@ -1682,57 +1769,44 @@ void loc_h(char *params) {
  */
 void ifc_h() {
   if (gpibBus.cfg.cmode==2) {
-    // Assert IFC
-    gpibBus.assertSignal(IFC_BIT);
-    delayMicroseconds(150);
-    // De-assert IFC
-    gpibBus.clearSignal(IFC_BIT);
+    // Assert IFC for 150 microseconds
+    gpibBus.sendIFC();
+#ifdef USE_INVENTORY
+    invMarkStale();
+#endif
     if (isVerb) dataPort.println(F("IFC signal asserted for 150 microseconds"));
   }
 }
 
 
 /***** Send a trigger command *****/
+/*
+ * All listed devices are addressed in one command sequence and
+ * then receive a single GET so that they trigger together.
+ */
 void trg_h(char *params) {
   const uint8_t maxparam = 15;
-  char *param;
-  uint8_t addrs[maxparam] = {0};
-  uint16_t val = 0;
+  uint8_t pris[maxparam];
+  uint8_t secs[maxparam];
   uint8_t cnt = 0;
 
-  addrs[0] = addrs[0]; // Meaningless as both are zero but defaults compiler warning!
-
   // Read parameters
   if (params == NULL) {
     // No parameters - trigger addressed device only
-    addrs[0] = gpibBus.cfg.paddr;
+    pris[0] = gpibBus.cfg.paddr;
+    secs[0] = gpibBus.cfg.saddr;
     cnt++;
   } else {
     // Read address parameters into array
-    while (cnt < maxparam) {
-      if (cnt == 0) {
-        param = strtok(params, " \t");
-      } else {
-        param = strtok(NULL, " \t");
-      }
-      if (param == NULL) {
-        break;  // Stop when there are no more parameters
-      }else{    
-        if (notInRange(param, 1, 30, val)) return;
-        addrs[cnt] = (uint8_t)val;
-        cnt++;
-      }
-    }
+    cnt = getAddrList(params, pris, secs, maxparam);
   }
 
   // If we have some addresses to trigger....
   if (cnt > 0) {
-    for (int i = 0; i < cnt; i++) {
-      // Sent GET to the requested device
-      if (gpibBus.sendGET(addrs[i]))  {
-        if (isVerb) dataPort.println(F("Failed to trigger device!"));
-        return;
-      }
+    // Sent GET to the requested devices
+    if (gpibBus.sendGroupGET(pris, secs, cnt))  {
+      if (isVerb) dataPort.println(F("Failed to trigger device!"));
+      return;
     }
 
     // Set GPIB controls back to idle state
@@ -1874,8 +1948,8 @@ void spoll_h(char *params) {
       addrval = addrs[i];
     }
 
-    // Don't need to poll own address
-    if (addrval != gpibBus.cfg.caddr) {
+    // Don't need to poll own address or addresses known to be empty
+    if ( (addrval != gpibBus.cfg.caddr) && !(all && gpibBus.isListenerAbsent(addrval, 0xFF)) ) {
 
       // Address a device to talk
       if ( gpibBus.sendCmd(GC_TAD + addrval) )  {
@@ -1977,6 +2051,9 @@ void stat_h(char *params) {
     // Byte value given?
     if (notInRange(params, 0, 255, statusByte)) return;
     gpibBus.setStatus((uint8_t)statusByte);
+#ifdef DEVICE_SUBADDR
+    subSrqUpdate();
+#endif
   } else {
     // Return the currently set status byte
     dataPort.println(gpibBus.cfg.stat);
@@ -1996,14 +2073,36 @@ void save_h() {
 
 
 /***** Show state or enable/disable listen only mode *****/
+/*
+ * Parameters: 0|1 [hpgl|page]
+ * hpgl: start a new line after each HP-GL ';' terminated instruction
+ * page: start a new line after each form feed
+ */
 void lon_h(char *params) {
   uint16_t lval;
+  char *split;
   if (params != NULL) {
+    split = strchr(params, ' ');
+    if (split) *split++ = '\0';
     if (notInRange(params, 0, 1, lval)) return;
+    lonSplit = 0;
+    if (split) {
+      if (strncasecmp(split, "hpgl", 4) == 0) {
+        lonSplit = 1;
+      } else if (strncasecmp(split, "page", 4) == 0) {
+        lonSplit = 2;
+      } else {
+        errorMsg(2);
+        return;
+      }
+    }
     isRO = lval ? true : false;
     if (isRO) {
       isTO = 0;       // Talk-only mode must be disabled!
       isProm = false; // Promiscuous mode must be disabled!
+#ifdef USE_CAPTURE
+      isCapt = false; // Capture mode must be disabled!
+#endif
     }
     if (isVerb) {
       dataPort.print(F("LON: "));
@@ -2112,6 +2211,9 @@ void dcl_h() {
     if (isVerb) dataPort.println(F("Sending DCL failed"));
     return;
   }
+#ifdef USE_INVENTORY
+  invMarkStale();
+#endif
   // Set GPIB controls back to idle state
   gpibBus.setControls(CIDS);
 }
@@ -2227,6 +2329,110 @@ void setvstr_h(char *params) {
 }
 
 
+#ifdef USE_CAPTURE
+/***** Show state or enable/disable bus capture mode *****/
+/*
+ * Parameters: [0|1|trig|stop|filter|pre]
+ * trig tad n|lad n|data text|none: start capture when device n is
+ *   addressed to talk or listen, or when data containing text is sent
+ * stop n|eoi|none: stop after n bytes or on a data byte sent with EOI
+ * filter addr addr...|none: capture only traffic to or from addresses
+ * pre n: keep n bytes from before the trigger
+ */
+void capt_h(char *params) {
+  uint16_t cval;
+  if ( (params != NULL) && !isNumber(params) ) {
+    captCfg(params);
+    return;
+  }
+  if (params != NULL) {
+    if (notInRange(params, 0, 1, cval)) return;
+    isCapt = cval ? true : false;
+    if (isCapt) {
+      isTO = 0;       // Talk-only mode must be disabled!
+      isRO = false;   // Listen-only mode must be disabled!
+      isProm = false; // Promiscuous mode must be disabled!
+      gpibCapture.start();
+    }
+    if (isVerb) {
+      dataPort.print(F("CAPTURE: "));
+      dataPort.println(cval ? "ON" : "OFF") ;
+    }
+  } else {
+    dataPort.println(isCapt);
+  }
+}
+
+
+/***** Set capture trigger, stop and filter conditions *****/
+void captCfg(char *params) {
+  uint16_t val = 0;
+  char *arg = strchr(params, ' ');
+
+  if (arg) arg++;
+
+  if (strncasecmp(params, "trig", 4) == 0) {
+    if (arg == NULL) {
+      errorMsg(1);
+    } else if (strncasecmp(arg, "none", 4) == 0) {
+      gpibCapture.setTrigger(CAP_TRIG_NONE, 0);
+    } else if (strncasecmp(arg, "tad ", 4) == 0) {
+      if (notInRange(arg + 4, 0, 30, val)) return;
+      gpibCapture.setTrigger(CAP_TRIG_TAD, (uint8_t)val);
+    } else if (strncasecmp(arg, "lad ", 4) == 0) {
+      if (notInRange(arg + 4, 0, 30, val)) return;
+      gpibCapture.setTrigger(CAP_TRIG_LAD, (uint8_t)val);
+    } else if (strncasecmp(arg, "data ", 5) == 0) {
+      if (gpibCapture.setPattern(arg + 5, strlen(arg + 5))) errorMsg(2);
+    } else {
+      errorMsg(2);
+    }
+  } else if (strncasecmp(params, "stop", 4) == 0) {
+    if (arg == NULL) {
+      errorMsg(1);
+    } else if (strncasecmp(arg, "none", 4) == 0) {
+      gpibCapture.stopCount = 0;
+      gpibCapture.stopOnEoi = false;
+    } else if (strncasecmp(arg, "eoi", 3) == 0) {
+      gpibCapture.stopOnEoi = true;
+    } else {
+      if (notInRange(arg, 1, 65535, val)) return;
+      gpibCapture.stopCount = val;
+    }
+  } else if (strncasecmp(params, "filter", 6) == 0) {
+    if (arg == NULL) {
+      errorMsg(1);
+    } else if (strncasecmp(arg, "none", 4) == 0) {
+      gpibCapture.filterMask = 0;
+    } else {
+      // Primary addresses separated by spaces
+      uint32_t mask = 0;
+      char *param = strtok(arg, " \t");
+      while (param) {
+        if (notInRange(param, 0, 30, val)) return;
+        mask |= (1UL << val);
+        param = strtok(NULL, " \t");
+      }
+      gpibCapture.filterMask = mask;
+    }
+  } else if (strncasecmp(params, "pre", 3) == 0) {
+    if (arg == NULL) {
+      errorMsg(1);
+      return;
+    }
+    if (notInRange(arg, 0, CAPTURE_SIZE - 1, val)) return;
+    gpibCapture.setPreTrigger(val);
+  } else {
+    errorMsg(2);
+    return;
+  }
+
+  // Re-arm with the new settings
+  gpibCapture.start();
+}
+#endif
+
+
 /***** Show state or enable/disable promiscuous mode *****/
 void prom_h(char *params) {
   uint16_t pval;
@@ -2236,6 +2442,9 @@ void prom_h(char *params) {
     if (isProm) {
       isTO = 0;     // Talk-only mode must be disabled!
       isRO = false; // Listen-only mode must be disabled!
+#ifdef USE_CAPTURE
+      isCapt = false; // Capture mode must be disabled!
+#endif
     }
     if (isVerb) {
       dataPort.print(F("PROM: "));
@@ -2249,14 +2458,36 @@ void prom_h(char *params) {
 
 
 /***** Talk only mode *****/
+/*
+ * Parameters: 0|1|2 [eoi|idle]
+ * eoi: assert EOI with the EOS terminator (1) or the end of each line (2)
+ * idle: assert EOI with the last byte when no more data is waiting
+ */
 void ton_h(char *params) {
   uint16_t toval;
+  char *eoimode;
   if (params != NULL) {
+    eoimode = strchr(params, ' ');
+    if (eoimode) *eoimode++ = '\0';
     if (notInRange(params, 0, 2, toval)) return;
+    tonEoi = 0;
+    if (eoimode) {
+      if (strncasecmp(eoimode, "eoi", 3) == 0) {
+        tonEoi = 1;
+      } else if (strncasecmp(eoimode, "idle", 4) == 0) {
+        tonEoi = 2;
+      } else {
+        errorMsg(2);
+        return;
+      }
+    }
     isTO = (uint8_t)toval;
     if (isTO>0) {
       isRO = false;   // Read-only mode must be disabled in TO mode!
       isProm = false; // Promiscuous mode must be disabled in TO mode!
+#ifdef USE_CAPTURE
+      isCapt = false; // Capture mode must be disabled in TO mode!
+#endif
     }
   }else{
     if (isVerb) {
@@ -2371,6 +2602,7 @@ void tct_h(char *params){
     }else{
       if (isVerb) dataPort.println(F(" succeeded."));
       gpibBus.startDeviceMode();
+      devUnaddress();
       if (isVerb) dataPort.println(F("Switched to device mode."));
     }
   }
@@ -2683,173 +2915,321 @@ bool isRange(char * rangestr, size_t rsize, unsigned long values[2] ) {
 }
 
 
+/***** Probe a list of addresses and update the bus map *****/
+bool scanBus(uint8_t addrList[], uint8_t acnt, bool withSec) {
+  uint16_t tmo = gpibBus.cfg.rtmo;
+  bool err = OK;
+
+  // Set minimal timeout
+  gpibBus.cfg.rtmo = 35;
+
+  for (uint8_t i=0; i<acnt; i++) {
+    // Ignore the controller address
+    if (addrList[i] == gpibBus.cfg.caddr) continue;
+    if (gpibBus.mapListener(addrList[i], withSec)) {
+      err = ERR;
+      break;
+    }
+  }
+
+  gpibBus.sendUNL();
+  gpibBus.cfg.rtmo = tmo;
+  gpibBus.setControls(CIDS);
+  return err;
+}
+
+
+/***** Addresses not yet covered by the bus map *****/
+/*
+ * With withSec set, addresses without a listener at the primary address
+ * also need their secondary addresses to have been swept.
+ */
+uint32_t unmappedAddrs(bool withSec) {
+  uint32_t allAddrs = 0x7FFFFFFF & ~(1UL << gpibBus.cfg.caddr);
+  uint32_t done = gpibBus.busMap.scanned;
+
+  if (withSec) done &= (gpibBus.busMap.swept | gpibBus.busMap.pri);
+  return (allAddrs & ~done);
+}
+
+
+/***** Find listeners *****/
+/*
+ * Parameters: [all|range|list] [nosec]
+ * With no parameters the result of the last full scan is returned if
+ * the bus map holds one, otherwise all addresses are scanned. Secondary
+ * addresses are checked unless 'nosec' is given. The bus map is kept
+ * until the next IFC. Further secondary addresses that did not fit in the
+ * bus map are shown as 'pri:...'.
+ */
 void fndl_h(char *params) {
   char *param;
+  char *opt;
   uint16_t addrval = 0;
-  uint8_t addrList[15] = {0};
-  uint16_t tmo = gpibBus.cfg.rtmo;
+  uint8_t addrList[31];
   uint8_t acnt = 0;
-  uint8_t i = 0;
-  uint8_t j = 0;
+  uint8_t fcnt = 0;
   uint8_t pri = 0xFF;
   unsigned long range[2] = {0,0};
-  bool list = false;
+  bool withSec = true;
+  bool cached = false;
 
-  // Initialise arrays
-  for (int i = 0; i < 15; i++) {
-    addrList[i] = 0;
+  // Secondary address sweep not required?
+  if (params != NULL) {
+    opt = strrchr(params, ' ');
+    param = opt ? (opt + 1) : params;
+    if (strcasecmp(param, "nosec") == 0) {
+      withSec = false;
+      if (opt) {
+        *opt = '\0';
+      }else{
+        params = NULL;
+      }
+    }
   }
 
-  // Set minimal timeout
-  gpibBus.cfg.rtmo = 35;
-
-  // Read parameters
   if (params == NULL) {
-    // No parameters given - no action to be taken
-  //  errorMsg(1);
-  //  return;
-    j = 31; // Same as 'all'
-  }
-
-  // Is it a range?
-  if ( isRange(params, strlen(params), range) ) {
+    // No parameters given - use the bus map if complete
+    if (unmappedAddrs(withSec) == 0) cached = true;
+    for (uint8_t i=0; i<31; i++) addrList[i] = i;
+    acnt = 31;
+  } else if ( strncasecmp(params, "all", 4) == 0) {
+    // Requested 'all'
+    for (uint8_t i=0; i<31; i++) addrList[i] = i;
+    acnt = 31;
+  } else if ( isRange(params, strlen(params), range) ) {
+    // Range of addresses
     if (range[0]<30 && range[1]<31) {
-      i = (uint8_t)range[0];
-      j = (uint8_t)range[1] + 1;
+      for (uint8_t i=(uint8_t)range[0]; i<=(uint8_t)range[1]; i++) {
+        addrList[acnt] = i;
+        acnt++;
+      }
     }else{
       errorMsg(2);
       return;
     }
+  } else {
+    // Read address parameters into array
+    param = strtok(params, " ,\t");
+    while (param && (acnt < 15)) {
+      // Valid GPIB address parameter ?
+      if ( (strlen(param) > 2) || !isNumber(param) ) {
+        errorMsg(2);
+        return;
+      }
+      if (notInRange(param, 0, 30, addrval)) return;
+      addrList[acnt] = (uint8_t)addrval;
+      acnt++;
+      param = strtok(NULL, " ,\t");
+    }
   }
 
-  // Requested 'all'?
-  if ( strncasecmp(params, "all", 4) == 0) {
-    j = 31;
+  // Probe the requested GPIB addresses
+  if (!cached) {
+    if (scanBus(addrList, acnt, withSec)) errorMsg(3);
   }
 
-  if (j==0) {
-    // Read address parameters into array
-    while (j < 15) {
-      if (j == 0) {
-        param = strtok(params, " ,\t");
-      } else {
-        param = strtok(NULL, " ,\t");
+  // Report listeners found
+  for (uint8_t i=0; i<acnt; i++) {
+    pri = addrList[i];
+    if (gpibBus.busMap.pri & (1UL << pri)) {
+      if (fcnt>0) dataPort.print(',');
+      dataPort.print(pri);
+      fcnt++;
+    }
+    for (uint8_t k=0; k<gpibBus.busMap.scnt; k++) {
+      if (gpibBus.busMap.spri[k] == pri) {
+        if (fcnt>0) dataPort.print(',');
+        dataPort.print(pri);
+        dataPort.print(':');
+        dataPort.print(gpibBus.busMap.ssec[k]);
+        fcnt++;
       }
+    }
+    if (gpibBus.busMap.trunc & (1UL << pri)) {
+      if (fcnt>0) dataPort.print(',');
+      dataPort.print(pri);
+      dataPort.print(F(":..."));
+      fcnt++;
+    }
+  }
 
-      // No further parameters so exit 
-      if (!param) break;
+  dataPort.println();
 
-      // Valid GPIB address parameter ?
-      if (strlen(param) > 2) {
-        errorMsg(2);
-        return;
-      }
+}
 
-      // Contains only digits
-      if (!isNumber(param)) {
-        errorMsg(2);
-        return;
-      }
 
-      // Valid range
-      if (notInRange(param, 0, 30, addrval)) return;
-      addrList[j] = (uint8_t)addrval;
-      j++;
+#ifdef USE_INVENTORY
+
+/***** Instrument inventory *****/
+/*
+ * Parameters: [refresh|clear|addr[,sec]]
+ * No parameters: show the whole inventory as held in RAM
+ * refresh: update the bus map and query new or stale entries
+ * clear: clear the inventory
+ * addr[,sec]: show a single entry, querying it first if stale
+ * Each line shows pri[:sec] and the *IDN? reply. Entries marked
+ * with * are stale, e.g. following IFC or DCL.
+ */
+void inv_h(char *params) {
+  uint8_t pris[1];
+  uint8_t secs[1];
 
+  if (params == NULL) {
+    for (uint8_t i=0; i<invCnt; i++) {
+      invShow(i);
+    }
+    if (isVerb) {
+      dataPort.print(invCnt);
+      dataPort.println(F(" instruments in inventory."));
+    }
+  } else if (strncasecmp(params, "refresh", 7) == 0) {
+    invRefresh();
+  } else if (strncasecmp(params, "clear", 5) == 0) {
+    invCnt = 0;
+  } else {
+    if (getAddrList(params, pris, secs, 1) == 0) return;
+    for (uint8_t i=0; i<invCnt; i++) {
+      if ( (inventory[i].pri == pris[0]) && (inventory[i].sec == secs[0]) ) {
+        if (inventory[i].stale) invQuery(i);
+        invShow(i);
+        return;
+      }
     }
+    if (isVerb) dataPort.println(F("Not in inventory."));
+  }
+}
 
-    list = true;
 
+/***** Show an inventory entry *****/
+void invShow(uint8_t idx) {
+  dataPort.print(inventory[idx].pri);
+  if (inventory[idx].sec != 0xFF) {
+    dataPort.print(':');
+    dataPort.print(inventory[idx].sec);
   }
+  if (inventory[idx].stale) dataPort.print('*');
+  dataPort.print('\t');
+  dataPort.println(inventory[idx].idn);
+}
 
-  // Poll the range of GPIB adresses
-  while (i<j) {
 
-    // Get from list or use actual value of iterator?
-    if (list) {
-      pri = addrList[i];
-    }else{
-      pri = i;
-    }
+/***** Rebuild the inventory from the bus map *****/
+/*
+ * Entries already held for an address are kept and only queried
+ * again if stale.
+ */
+void invRefresh() {
+  uint8_t addrList[31];
+  uint32_t todo = unmappedAddrs(true);
+  uint8_t acnt = 0;
+  uint8_t cnt = 0;
 
-    // Ignore the controller address
-    if (pri == gpibBus.cfg.caddr) {
-      i++;
-      continue;
+  // Scan the addresses that the map does not cover yet
+  for (uint8_t i=0; i<31; i++) {
+    if (todo & (1UL << i)) {
+      addrList[acnt] = i;
+      acnt++;
     }
+  }
+  if (acnt && scanBus(addrList, acnt, true)) {
+    errorMsg(3);
+    return;
+  }
 
-//Serial.print("PRI: ");
-//Serial.println(pri);
-
-    // Send UNL + UNT + LAD (addressDevice function adds 0x20 to pri)
-    if (gpibBus.addressDevice(pri, 0xFF, TOLISTEN) == ERR) {
-      errorMsg(3);
-      break;
+  // Drop entries for instruments no longer on the bus
+  for (uint8_t i=0; i<invCnt; i++) {
+    if (isInBusMap(inventory[i].pri, inventory[i].sec)) {
+      if (i != cnt) inventory[cnt] = inventory[i];
+      cnt++;
     }
+  }
+  invCnt = cnt;
 
-    gpibBus.clearSignal(ATN_BIT);
-    delayMicroseconds(1600);
+  // Add new instruments
+  for (uint8_t pri=0; pri<31; pri++) {
+    if (gpibBus.busMap.pri & (1UL << pri)) invAdd(pri, 0xFF);
+  }
+  for (uint8_t k=0; k<gpibBus.busMap.scnt; k++) {
+    invAdd(gpibBus.busMap.spri[k], gpibBus.busMap.ssec[k]);
+  }
 
-    if (gpibBus.isAsserted(NDAC_PIN)) {
- 
-      if (acnt>0) Serial.print(',');
-      dataPort.print(pri);
-      acnt++;
+  // Query new and stale entries
+  for (uint8_t i=0; i<invCnt; i++) {
+    if (inventory[i].stale) invQuery(i);
+  }
 
-    }else{
+  if (isVerb) {
+    dataPort.print(invCnt);
+    dataPort.println(F(" instruments in inventory."));
+  }
+}
 
-      // Send all secondary addresses
-      gpibBus.assertSignal(ATN_BIT);
-      for (uint8_t sec=0x60; sec<0x7F; sec++){
-        gpibBus.writeByte(sec, false);
-      }
-      
-      gpibBus.clearSignal(ATN_BIT);
-      delayMicroseconds(1600);
-
-      if (gpibBus.isAsserted(NDAC_PIN)) {
-        gpibBus.assertSignal(ATN_BIT);
-        gpibBus.writeByte(GC_UNL, false);
-        gpibBus.writeByte( (pri+0x20), false ); // LAD
-
-        for (uint8_t sec=0x60; sec<0x7F; sec++){
-          gpibBus.writeByte(sec, false);
-          gpibBus.clearSignal(ATN_BIT);
-          delayMicroseconds(1600);
-          if (gpibBus.isAsserted(NDAC_PIN)) {
-            if (acnt>0) dataPort.print(',');
-            acnt++;
-            dataPort.print(pri);
-            dataPort.print(':');
-            dataPort.print(sec);
-
-            gpibBus.assertSignal(ATN_BIT);
-            gpibBus.writeByte(GC_UNL, false);
-            gpibBus.writeByte((pri+0x20), false); // LAD
-          }else{
-            gpibBus.assertSignal(ATN_BIT);
-            gpibBus.writeByte(GC_UNT, false);
-          }
-        }
 
-        gpibBus.clearSignal(ATN_BIT);
-        delayMicroseconds(1600);
+/***** Add an address to the inventory if not already present *****/
+void invAdd(uint8_t pri, uint8_t sec) {
+  for (uint8_t i=0; i<invCnt; i++) {
+    if ( (inventory[i].pri == pri) && (inventory[i].sec == sec) ) return;
+  }
+  if (invCnt == INVENTORY_SIZE) return;
+  inventory[invCnt].pri = pri;
+  inventory[invCnt].sec = sec;
+  inventory[invCnt].stale = true;
+  inventory[invCnt].idn[0] = '\0';
+  invCnt++;
+}
 
-      }
 
-    } // End if NDAC aserted (else)
+/***** Can the listener still be on the bus according to the bus map? *****/
+/*
+ * Secondary addresses are only ruled out when the map holds a complete
+ * sweep for the primary address.
+ */
+bool isInBusMap(uint8_t pri, uint8_t sec) {
+  if (sec == 0xFF) return (gpibBus.busMap.pri & (1UL << pri));
+  return !gpibBus.isListenerAbsent(pri, sec);
+}
 
-    gpibBus.setControls(CIDS);
-    i++;
 
-  } // END while
+/***** Query an instrument with *IDN? and save the reply *****/
+void invQuery(uint8_t idx) {
+  BUFSTREAM idnStream(inventory[idx].idn, INVENTORY_IDN_LEN);
+  uint8_t pri = inventory[idx].pri;
+  uint8_t sec = inventory[idx].sec;
+  size_t len;
+  bool err = ERR;
 
-  dataPort.println();
-  gpibBus.cfg.rtmo = tmo;
+  if (gpibBus.addressDevice(pri, sec, TOLISTEN) == OK) {
+    gpibBus.sendData("*IDN?", 5);
+    if (gpibBus.addressDevice(pri, sec, TOTALK) == OK) {
+      gpibBus.receiveData(idnStream, gpibBus.cfg.eoi, false, 0);
+      err = OK;
+    }
+  }
+  // Leave the bus unaddressed on every path
+  gpibBus.unAddressDevice();
   gpibBus.setControls(CIDS);
+  if (err) return;
+
+  // Strip the terminator and EOT character
+  len = idnStream.length();
+  while (len && ((uint8_t)inventory[idx].idn[len-1] < 0x20 || (gpibBus.cfg.eot_en && inventory[idx].idn[len-1] == gpibBus.cfg.eot_ch))) {
+    len--;
+    inventory[idx].idn[len] = '\0';
+  }
+  inventory[idx].stale = false;
+}
+
 
+/***** Mark the whole inventory as out of date *****/
+void invMarkStale() {
+  for (uint8_t i=0; i<invCnt; i++) {
+    inventory[i].stale = true;
+  }
 }
 
+#endif
+
 
 /***** Send to secondary address *****/
 /*
@@ -2917,8 +3297,10 @@ Serial.println(param);
 */
 
 //    gpibBus.unAddressDevice();
-    gpibBus.addressDevice(pri, sec, TOLISTEN);
-    gpibBus.sendData(param, strlen(param));
+    if (gpibBus.sendSecondaryCmd(pri, sec, param, strlen(param))) {
+      if (isVerb) dataPort.println(F("Failed to send data"));
+      return;
+    }
 
     if ( (gpibBus.cfg.amode == 1) || ((gpibBus.cfg.amode == 2) && isQuery) ) {
       gpibBus.addressDevice(pri, sec, TOTALK);
@@ -2935,244 +3317,887 @@ Serial.println(param);
 }
 
 
-/***** Send device clear (usually resets the device to power on state) *****/
-void unlisten_h() {
-  if (gpibBus.sendUNL())  {
-    if (isVerb) dataPort.println(F("Failed to send UNL"));
-    return;
-  }
-  // Set GPIB controls back to idle state
-  gpibBus.setControls(CIDS);
-}
-
+/***** Read a list of GPIB addresses *****/
+/*
+ * Parameters: pri[,sec] pri[,sec] ...
+ * pri = primary address between 0 and 30
+ * sec = optional secondary address between 0 and 30 or 96 and 126
+ * Secondary addresses are returned with 0x60 added or 0xFF if not
+ * given. Returns the number of addresses read or 0 on error.
+ */
+uint8_t getAddrList(char *params, uint8_t pris[], uint8_t secs[], uint8_t maxcnt) {
+  char *param;
+  char *secp;
+  uint16_t val;
+  uint8_t cnt = 0;
 
-/***** Send device clear (usually resets the device to power on state) *****/
-void untalk_h() {
-  if (gpibBus.sendUNT())  {
-    if (isVerb) dataPort.println(F("Failed to send UNT"));
-    return;
-  }
-  // Set GPIB controls back to idle state
-  gpibBus.setControls(CIDS);
-}
+  param = strtok(params, " \t");
+  while (param) {
 
+    if (cnt == maxcnt) {
+      errorMsg(2);
+      return 0;
+    }
 
+    // Split off the secondary address
+    secp = strchr(param, ',');
+    if (secp) {
+      *secp = '\0';
+      secp++;
+    }
 
-/******************************************************/
-/***** Device mode GPIB command handling routines *****/
-/******************************************************/
+    // Primary address numeric, in range and not the controller ?
+    if (!isNumber(param)) {
+      errorMsg(2);
+      return 0;
+    }
+    if (notInRange(param, 0, 30, val)) return 0;
+    if (val == gpibBus.cfg.caddr) {
+      errorMsg(2);
+      return 0;
+    }
+    pris[cnt] = (uint8_t)val;
+    secs[cnt] = 0xFF;
 
-/***** Attention handling routine *****/
+    // Secondary address in range ?
+    if (secp) {
+      if (strlen(secp) == 0 || !isNumber(secp)) {
+        errorMsg(2);
+        return 0;
+      }
+      val = strtoul(secp, NULL, 10);
+      if (val<31) val = val + 0x60;
+      if (val<0x60 || val>0x7E) {
+        errorMsg(2);
+        return 0;
+      }
+      secs[cnt] = (uint8_t)val;
+    }
+
+    cnt++;
+    param = strtok(NULL, " \t");
+  }
+
+  return cnt;
+}
+
+
+/***** Send the same data to several listeners *****/
+/*
+  Parameters: pri[,sec] pri[,sec] ... :data
+  All listed devices are addressed as listeners in one command
+  sequence and the data is then sent to the bus only once.
+*/
+void msend_h(char *params) {
+  const uint8_t maxparam = 15;
+  uint8_t pris[maxparam];
+  uint8_t secs[maxparam];
+  uint8_t cnt = 0;
+  char *data;
+
+  if (params == NULL) {
+    errorMsg(1);
+    return;
+  }
+
+  // Data follows the address list after a ':'
+  data = strchr(params, ':');
+  if ( (data == NULL) || (*(data+1) == '\0') ) {
+    errorMsg(1);
+    return;
+  }
+  *data = '\0';
+  data++;
+
+  cnt = getAddrList(params, pris, secs, maxparam);
+  if (cnt == 0) {
+    if (strlen(params) == 0) errorMsg(1);
+    return;
+  }
+
+  if (gpibBus.addressListeners(pris, secs, cnt)) {
+    errorMsg(3);
+    gpibBus.setControls(CIDS);
+    return;
+  }
+
+  gpibBus.sendData(data, strlen(data));
+  gpibBus.unAddressDevice();
+
+  // Set GPIB controls back to idle state
+  gpibBus.setControls(CIDS);
+
+  if (gpibBus.cfg.hflags & 0x04) showFlag(F("Send^OK"));
+}
+
+
+/***** Transfer data directly from a talker to one or more listeners *****/
+/*
+  Parameters: tpri[,tsec] lpri[,lsec] ... [mon]
+  The first address is the talker and the remaining addresses are the
+  listeners. The controller is an active acceptor during the transfer:
+  it drives NRFD/NDAC for every byte, so the transfer runs no faster than
+  the controller accepts, but the data is discarded. All devices are
+  unaddressed at the end. With 'mon' the data is also passed to the
+  serial port. The transfer ends on EOI or terminator in the same way as
+  ++read, on a timeout or when interrupted, and verbose mode reports
+  which.
+*/
+void xfer_h(char *params) {
+  const uint8_t maxparam = 15;
+  uint8_t pris[maxparam + 1];
+  uint8_t secs[maxparam + 1];
+  uint8_t cnt = 0;
+  bool monitor = false;
+  char *opt;
+  enum receiveState rstate;
+
+  if (params == NULL) {
+    errorMsg(1);
+    return;
+  }
+
+  // Monitor option?
+  opt = strrchr(params, ' ');
+  if (opt && (strcasecmp(opt+1, "mon") == 0)) {
+    monitor = true;
+    *opt = '\0';
+  }
+
+  cnt = getAddrList(params, pris, secs, maxparam);
+  if (cnt == 0) return;
+  if (cnt < 2) {
+    errorMsg(1);
+    return;
+  }
+
+  // Controller joins the listeners when monitoring
+  if (monitor) {
+    pris[cnt] = gpibBus.cfg.caddr;
+    secs[cnt] = 0xFF;
+    cnt++;
+  }
+
+  // Address listeners followed by the talker
+  if ( gpibBus.addressListeners(&pris[1], &secs[1], cnt-1) ||
+       gpibBus.sendCmd(GC_TAD + pris[0]) ||
+       ((secs[0] != 0xFF) && gpibBus.sendCmd(secs[0])) ) {
+    errorMsg(3);
+    gpibBus.setControls(CIDS);
+    return;
+  }
+
+  if (monitor) {
+    rstate = gpibBus.receiveData(dataPort, gpibBus.cfg.eoi, false, 0);
+  }else{
+    rstate = gpibBus.waitTransfer(gpibBus.cfg.eoi, false, 0);
+  }
+
+  gpibBus.unAddressDevice();
+
+  // Set GPIB controls back to idle state
+  gpibBus.setControls(CIDS);
+
+  if (isVerb) {
+    switch (rstate) {
+      case RECEIVE_ERR:
+        dataPort.println(F("Transfer timed out."));
+        break;
+      case RECEIVE_BREAK:
+        dataPort.println(F("Transfer interrupted."));
+        break;
+      case RECEIVE_EOI:
+        dataPort.println(F("Transfer completed (EOI)."));
+        break;
+      case RECEIVE_ENDL:
+      case RECEIVE_ENDCHAR:
+        dataPort.println(F("Transfer completed (terminator)."));
+        break;
+      default:
+        dataPort.print(F("Transfer ended, state: "));
+        dataPort.println((uint8_t)rstate);
+    }
+  }
+}
+
+
+/***** Send device clear (usually resets the device to power on state) *****/
+void unlisten_h() {
+  if (gpibBus.sendUNL())  {
+    if (isVerb) dataPort.println(F("Failed to send UNL"));
+    return;
+  }
+  // Set GPIB controls back to idle state
+  gpibBus.setControls(CIDS);
+}
+
+
+/***** Send device clear (usually resets the device to power on state) *****/
+void untalk_h() {
+  if (gpibBus.sendUNT())  {
+    if (isVerb) dataPort.println(F("Failed to send UNT"));
+    return;
+  }
+  // Set GPIB controls back to idle state
+  gpibBus.setControls(CIDS);
+}
+
+
+
+#ifdef DEVICE_TALK_QUEUE
+
+/***** Device mode talker output queue *****/
 /*
- * In device mode is invoked whenever ATN is asserted
+ * Parameters: [add data|sub n data|clear]
+ * add: queue data to be sent when next addressed to talk. The EOS
+ * terminator is appended and EOI asserted with the last byte.
+ * sub: queue data for sub-device n (if compiled)
+ * clear: empty the queue
+ * No parameters: show the number of responses queued
  */
-void attnRequired() {
+void talkq_h(char *params) {
+  uint8_t tag = TQ_PRIMARY;
+  char *data;
 
-  const uint8_t cmdbuflen = 35;
-  uint8_t cmdbytes[cmdbuflen] = {0};
-  uint8_t db = 0;
-  bool eoiDetected = false;
-  uint8_t gpibcmd = 0;
-  uint8_t bytecnt = 0;
-  uint8_t atnstat = 0;
-  uint8_t ustat = 0;
-  bool addressed = false;
+  if (params == NULL) {
+    dataPort.println(tqFrames);
+    if (isVerb) {
+      dataPort.print(TALKQ_SIZE - tqUsed);
+      dataPort.println(F(" bytes free."));
+    }
+    return;
+  }
 
-#ifdef EN_STORAGE
-  uint8_t saddrcmd = 0;
-#endif
+  if (strncasecmp(params, "clear", 5) == 0) {
+    tqClear();
+    return;
+  }
 
-#ifdef DEBUG_DEVICE_ATN
-  uint8_t cmdbyteslist[cmdbuflen] = {0};
-  uint8_t listbytecnt = 0;
+  if (strncasecmp(params, "add ", 4) == 0) {
+    data = params + 4;
+#ifdef DEVICE_SUBADDR
+  } else if (strncasecmp(params, "sub ", 4) == 0) {
+    uint16_t val;
+    char *sep = strchr(params + 4, ' ');
+    if (sep == NULL) {
+      errorMsg(1);
+      return;
+    }
+    *sep = '\0';
+    if (notInRange(params + 4, 0, 30, val)) return;
+    tag = (uint8_t)val;
+    data = sep + 1;
 #endif
+  } else {
+    errorMsg(2);
+    return;
+  }
 
-  // Set device listner active state (assert NDAC+NRFD (low), DAV=INPUT_PULLUP)
-  gpibBus.setControls(DLAS);
+  if (tqPush(data, strlen(data), tag)) {
+    errorMsg(2);
+    if (isVerb) dataPort.println(F("Talk queue full!"));
+  }
+}
 
-  /***** ATN read loop *****/
-  // Read bytes received while ATN is asserted
-  while ( (gpibBus.isAsserted(ATN_PIN)) && (bytecnt<cmdbuflen) ) {
 
-    // Read the next byte from the bus, no EOI detection. Exit loop on error·
-    if (gpibBus.readByte(&db, false, &eoiDetected) != HANDSHAKE_COMPLETE ) break;
+/***** Queue a response frame *****/
+/*
+ * Frames are held as [length][tag][data]. The tag is TQ_PRIMARY or the
+ * sub-device number the frame is to be sent from.
+ */
+bool tqPush(const char *data, uint8_t dsize, uint8_t tag) {
+  uint8_t tsize = 0;
+  uint8_t pos = tqUsed;
+  char tc[2];
 
-    // Untalk or unlisten
-    cmdbytes[bytecnt] = db;
-    bytecnt++;
+  // EOS terminator
+  switch (gpibBus.cfg.eos) {
+    case 1:
+      tc[tsize++] = CR;
+      break;
+    case 2:
+      tc[tsize++] = LF;
+      break;
+    case 3:
+      break;
+    default:
+      tc[tsize++] = CR;
+      tc[tsize++] = LF;
+  }
 
-#ifdef DEBUG_DEVICE_ATN
-    cmdbyteslist[listbytecnt] = db;
-    listbytecnt++;
+  if ( ((uint16_t)dsize + tsize) > 255 ) return ERR;
+  if ( (tqUsed + 2 + dsize + tsize) > TALKQ_SIZE ) return ERR;
+
+  talkQ[pos++] = dsize + tsize;
+  talkQ[pos++] = tag;
+  memcpy(&talkQ[pos], data, dsize);
+  memcpy(&talkQ[pos + dsize], tc, tsize);
+  tqUsed += 2 + dsize + tsize;
+  tqFrames++;
+  return OK;
+}
+
+
+/***** Send the oldest frame with the given tag *****/
+/*
+ * EOI is asserted with the last byte. Returns ERR if nothing is queued
+ * for the tag.
+ */
+bool tqSend(uint8_t tag) {
+  uint8_t pos = 0;
+  uint8_t fsize;
+
+  // Find the frame
+  while (pos < tqUsed) {
+    if (talkQ[pos + 1] == tag) break;
+    pos += 2 + talkQ[pos];
+  }
+  if (pos >= tqUsed) return ERR;
+
+  gpibBus.setControls(DTAS);
+  gpibBus.writeBlock(&talkQ[pos + 2], talkQ[pos], WITH_EOI);
+  gpibBus.setControls(DIDS);
+
+  // Remove it from the queue (even if the controller aborted)
+  fsize = 2 + talkQ[pos];
+  memmove(&talkQ[pos], &talkQ[pos + fsize], tqUsed - pos - fsize);
+  tqUsed -= fsize;
+  tqFrames--;
+  return OK;
+}
+
+
+#ifdef DEVICE_SUBADDR
+/***** Drop the oldest frame with the given tag *****/
+bool tqDiscard(uint8_t tag) {
+  uint8_t pos = 0;
+  uint8_t fsize;
+
+  while (pos < tqUsed) {
+    fsize = 2 + talkQ[pos];
+    if (talkQ[pos + 1] == tag) {
+      memmove(&talkQ[pos], &talkQ[pos + fsize], tqUsed - pos - fsize);
+      tqUsed -= fsize;
+      tqFrames--;
+      return OK;
+    }
+    pos += fsize;
+  }
+  return ERR;
+}
 #endif
+
+
+/***** Empty the talker output queue *****/
+void tqClear() {
+  tqUsed = 0;
+  tqFrames = 0;
+}
+
+#endif
+
+#ifdef DEVICE_SUBADDR
+
+/***** Device mode sub-devices *****/
+/*
+ * Parameters: [sec sec...|none|stat n [byte]]
+ * sec: enable sub-devices at the listed secondary addresses (0-30)
+ * none: disable all sub-devices
+ * stat: show or set the status byte of sub-device n (bit 6 = RQS)
+ * No parameters: list the enabled sub-devices
+ */
+void subdev_h(char *params) {
+  uint16_t val;
+  uint32_t mask = 0;
+  char *param;
+
+  if (params == NULL) {
+    for (uint8_t i=0; i<31; i++) {
+      if (subMask & (1UL << i)) {
+        dataPort.print(i);
+        dataPort.print(' ');
+      }
+    }
+    dataPort.println();
+    return;
   }
 
-  // ATN read loop completed
-  atnstat |= 0x01;
+  if (strncasecmp(params, "none", 4) == 0) {
+    subMask = 0;
+    memset(subStat, 0, sizeof(subStat));
+    subSrqUpdate();
+    return;
+  }
 
-  /***** Promiscuous mode *****/
-  // Don't process anything, just listen and repeat to USB
-  if (isProm) {
-    device_listen_h();
-    gpibBus.setControls(DINI);
+  if (strncasecmp(params, "stat ", 5) == 0) {
+    param = strtok(params + 5, " \t");
+    if (notInRange(param, 0, 30, val)) return;
+    uint8_t sub = (uint8_t)val;
+    param = strtok(NULL, " \t");
+    if (param == NULL) {
+      dataPort.println(subStat[sub]);
+      return;
+    }
+    if (notInRange(param, 0, 255, val)) return;
+    subStat[sub] = (uint8_t)val;
+    subSrqUpdate();
     return;
   }
 
-  
-  /***** Command process loop *****/
-  // Process received addresses and command tokens
-  if (bytecnt>0) {
+  // List of secondary addresses
+  param = strtok(params, " \t");
+  while (param) {
+    if (notInRange(param, 0, 30, val)) return;
+    mask |= (1UL << val);
+    param = strtok(NULL, " \t");
+  }
+  // Must not clash with the secondary address of the interface itself
+  if ( (gpibBus.cfg.saddr != 0xFF) && (mask & (1UL << (gpibBus.cfg.saddr - 0x60))) ) {
+    errorMsg(2);
+    if (isVerb) dataPort.println(F("Secondary address in use by the interface!"));
+    return;
+  }
+  subMask = mask;
+}
 
-    // Process received command tokens
-    for (uint8_t i=0; i<bytecnt; i++) { 
 
-//      if (!cmdbytes[i]) break;  // End loop on zero
+/***** Assert SRQ while the interface or any sub-device requests service *****/
+void subSrqUpdate() {
+  bool rqs = (gpibBus.cfg.stat & 0x40);
+  for (uint8_t i=0; i<31; i++) {
+    if ( (subMask & (1UL << i)) && (subStat[i] & 0x40) ) rqs = true;
+  }
+  if (rqs) {
+    gpibBus.assertSignal(SRQ_BIT);
+  } else {
+    gpibBus.clearSignal(SRQ_BIT);
+  }
+}
 
-      db = cmdbytes[i];
+#endif
 
-      // Unlisten
-      if (db == 0x3F) {
-        if (!device_unl_h()) ustat &= ~0x01; // Clears bit if UNL was not required
-        continue;
+#ifdef DEVICE_RESP_TABLE
+
+/***** Device mode query/response table *****/
+/*
+ * Parameters: [add query|response|del n|clear|save|stats]
+ * add: add an entry. A query ending in '*' matches any query
+ * starting with the preceding characters. Case is ignored.
+ * del: remove entry n
+ * clear: remove all entries and reset the counters
+ * save: save the table to EEPROM
+ * stats: show the number of queries answered (hits) and passed
+ * to the host (misses)
+ * No parameters: list the table
+ */
+void resp_h(char *params) {
+  uint16_t val = 0;
+  char *sep;
+
+  if (params == NULL) {
+    respShow();
+  } else if (strncasecmp(params, "add ", 4) == 0) {
+    sep = strchr(params + 4, '|');
+    if (sep == NULL) {
+      errorMsg(1);
+      return;
+    }
+    *sep = '\0';
+    if (respAdd(params + 4, sep + 1)) {
+      errorMsg(2);
+      if (isVerb) dataPort.println(F("Response table full!"));
+    }
+  } else if (strncasecmp(params, "del ", 4) == 0) {
+    if (notInRange(params + 4, 1, 255, val)) return;
+    if (respDel((uint8_t)val)) errorMsg(2);
+  } else if (strncasecmp(params, "clear", 5) == 0) {
+    memset(respTbl, 0, RESP_TABLE_SIZE);
+    respHits = 0;
+    respMisses = 0;
+  } else if (strncasecmp(params, "save", 4) == 0) {
+#ifdef E2END
+    epWriteArea(EERESP, respTbl, RESP_TABLE_SIZE);
+    if (isVerb) dataPort.println(F("Response table saved."));
+#else
+    dataPort.println(F("EEPROM not supported."));
+#endif
+  } else if (strncasecmp(params, "stats", 5) == 0) {
+    dataPort.print(respHits);
+    dataPort.print(F(","));
+    dataPort.println(respMisses);
+  } else {
+    errorMsg(2);
+  }
+}
+
+
+/***** Size of the next table entry at pos (0 = end of table) *****/
+uint8_t respEntrySize(uint8_t pos) {
+  uint16_t rpos;
+  if ( (pos >= RESP_TABLE_SIZE) || (respTbl[pos] == 0) ) return 0;
+  rpos = pos + 1 + respTbl[pos];
+  // Corrupt entry
+  if ( rpos >= RESP_TABLE_SIZE ) return 0;
+  if ( (rpos + 1 + respTbl[rpos]) > RESP_TABLE_SIZE ) return 0;
+  return (rpos + 1 + respTbl[rpos]) - pos;
+}
+
+
+/***** List the query/response table *****/
+void respShow() {
+  uint8_t pos = 0;
+  uint8_t esize;
+  uint8_t idx = 1;
+
+  while ( (esize = respEntrySize(pos)) ) {
+    dataPort.print(idx);
+    dataPort.print(F(": "));
+    dataPort.write(&respTbl[pos + 1], respTbl[pos]);
+    dataPort.print(F("|"));
+    dataPort.write(&respTbl[pos + 2 + respTbl[pos]], esize - 2 - respTbl[pos]);
+    dataPort.println();
+    pos += esize;
+    idx++;
+  }
+  if (isVerb && (idx == 1)) dataPort.println(F("Response table empty."));
+}
+
+
+/***** Add an entry to the end of the table *****/
+bool respAdd(char *query, char *resp) {
+  uint8_t pos = 0;
+  uint8_t esize;
+  size_t qlen = strlen(query);
+  size_t rlen = strlen(resp);
+
+  if ( (qlen == 0) || (qlen >= RESP_QUERY_LEN) ) return ERR;
+
+  // Find the end of the table
+  while ( (esize = respEntrySize(pos)) ) pos += esize;
+  if ( (pos + 2 + qlen + rlen) > RESP_TABLE_SIZE ) return ERR;
+
+  respTbl[pos++] = qlen;
+  memcpy(&respTbl[pos], query, qlen);
+  pos += qlen;
+  respTbl[pos++] = rlen;
+  memcpy(&respTbl[pos], resp, rlen);
+  pos += rlen;
+  // Mark the end of the table
+  if (pos < RESP_TABLE_SIZE) respTbl[pos] = 0;
+  return OK;
+}
+
+
+/***** Remove entry number idx (from 1) *****/
+bool respDel(uint8_t idx) {
+  uint8_t pos = 0;
+  uint8_t esize;
+
+  while ( (esize = respEntrySize(pos)) ) {
+    if (idx == 1) {
+      memmove(&respTbl[pos], &respTbl[pos + esize], RESP_TABLE_SIZE - pos - esize);
+      memset(&respTbl[RESP_TABLE_SIZE - esize], 0, esize);
+      return OK;
+    }
+    pos += esize;
+    idx--;
+  }
+  return ERR;
+}
+
+
+/***** Queue the response to a matching query *****/
+/*
+ * Trailing CR, LF and EOT characters are ignored when matching.
+ * Returns OK if the query was answered.
+ */
+bool respServe(char *query, size_t qlen) {
+  uint8_t pos = 0;
+  uint8_t esize;
+  uint8_t plen;
+  char *pattern;
+  bool match;
+
+  while ( (qlen > 0) && ( (query[qlen-1] == CR) || (query[qlen-1] == LF) ||
+          (gpibBus.cfg.eot_en && (query[qlen-1] == gpibBus.cfg.eot_ch)) ) ) {
+    qlen--;
+  }
+  if (qlen == 0) return ERR;
+
+  while ( (esize = respEntrySize(pos)) ) {
+    plen = respTbl[pos];
+    pattern = (char *)&respTbl[pos + 1];
+    if (pattern[plen-1] == '*') {
+      match = (qlen >= (size_t)(plen - 1)) && (strncasecmp(query, pattern, plen - 1) == 0);
+    } else {
+      match = (qlen == plen) && (strncasecmp(query, pattern, plen) == 0);
+    }
+    if (match) {
+      // Response is sent when next addressed to talk
+      return tqPush((char *)&respTbl[pos + 2 + plen], esize - 2 - plen, TQ_PRIMARY);
+    }
+    pos += esize;
+  }
+  return ERR;
+}
+
+#endif
+
+/******************************************************/
+/***** Device mode GPIB command handling routines *****/
+/******************************************************/
+
+/***** Return the device to the unaddressed state *****/
+void devUnaddress() {
+  devLads = false;
+  devTads = false;
+#ifdef DEVICE_SUBADDR
+  devSub = 0xFF;
+#endif
+}
+
+
+/***** Attention handling routine *****/
+/*
+ * In device mode is invoked whenever ATN is asserted. Each command
+ * byte is decoded as soon as it has been received, so there is no
+ * limit on the length of the command sequence. Addressed commands act
+ * on the addressing state at the time they are received. The listen
+ * and talk address states (devLads/devTads) are kept between ATN
+ * sequences until UNL, UNT, another talk address or IFC.
+ */
+void attnRequired() {
+
+  uint8_t db = 0;
+  bool eoiDetected = false;
+  bool secPending = false;      // MLA/MTA waiting for our secondary address
+  bool tctReceived = false;
+  uint8_t atnstat = 0;
+  uint8_t bytecnt = 0;
+  enum gpibHandshakeState state;
+
+  // Set device listner active state (assert NDAC+NRFD (low), DAV=INPUT_PULLUP)
+  // (may already have been done by the ATN interrupt handler)
+  gpibBus.setControls(DLAS);
+  gpibBus.clearAtnPending();
+
+  /***** ATN read loop *****/
+  // Read and decode bytes received while ATN is asserted
+  while (gpibBus.isAsserted(ATN_PIN)) {
+
+    // Serial poll: send the status byte the moment ATN is released
+    if (devTads && isSpoll && !secPending) {
+      if (gpibBus.spollRespond(spollStatus())) {
+        spollDone();
+        atnstat |= 0x20;
+#ifdef DEBUG_DEVICE_ATN
+        showATNStatus(atnstat, bytecnt);
+#endif
+        return;
       }
+      // Timed out, otherwise more command bytes follow
+      if (!gpibBus.isAsserted(DAV_PIN)) break;
+    }
 
-      // Untalk
-      if (db == 0x5F) {
-        if (!device_unt_h()) ustat &= ~0x02; // Clears bit if UNT was not required
+    // Read the next byte from the bus, no EOI detection. Exit loop on error
+    state = gpibBus.readByte(&db, false, &eoiDetected);
+    if (state == IFC_ASSERTED) devUnaddress();
+    if (state != HANDSHAKE_COMPLETE) break;
+    if (bytecnt < 255) bytecnt++;
+#ifdef DEBUG_DEVICE_ATN
+    DB_HEX_PRINT(db);
+#endif
+
+    // Promiscuous mode - don't process anything
+    if (isProm) continue;
+
+    db &= 0x7F;
+
+    // Extended addressing: MLA/MTA followed by our secondary address
+    if (secPending) {
+      secPending = false;
+      if (db == gpibBus.cfg.saddr) {
+        atnstat |= 0x10;
         continue;
       }
+#ifdef DEVICE_SUBADDR
+      // Sub-device selected
+      if ( (db >= 0x60) && (db < 0x7F) && (subMask & (1UL << (db - 0x60))) ) {
+        devSub = db - 0x60;
+        atnstat |= 0x10;
+        continue;
+      }
+#endif
+      // Not our secondary address (without extended addressing
+      // the primary address alone is enough)
+      if ( (gpibBus.cfg.saddr != 0xFF) || (db >= 0x60) ) {
+        devLads = false;
+        devTads = false;
+      }
+    }
+
+    if (db == GC_UNL) {
+      // Unlisten
+      devLads = false;
+
+    } else if (db == GC_UNT) {
+      // Untalk
+      devTads = false;
 
+    } else if (db == (GC_LAD | gpibBus.cfg.paddr)) {
       // Device is addressed to listen
-      if (gpibBus.cfg.paddr == (db ^ 0x20)) { // MLA = db^0x20
-        atnstat |= 0x02;
-        addressed = true;
-        gpibBus.setControls(DLAS);
+      devLads = true;
+      devTads = false;
+#ifdef DEVICE_SUBADDR
+      devSub = 0xFF;    // Until a sub-device secondary address follows
+#endif
+      secPending = isSecExpected();
+      atnstat |= 0x02;
 
+    } else if (db == (GC_TAD | gpibBus.cfg.paddr)) {
       // Device is addressed to talk
-      }else if (gpibBus.cfg.paddr == (db ^ 0x40)) { // MLA = db^0x40
-        // Call talk handler to send data
-        atnstat |= 0x04;
-        addressed = true;
-        gpibBus.setControls(DTAS);
-
-#ifdef EN_STORAGE
-      }else if (db>0x5F && db<0x80) {
-        // Secondary addressing command received
-        saddrcmd = db;
-        atnstat |= 0x10;
+      devTads = true;
+      devLads = false;
+#ifdef DEVICE_SUBADDR
+      devSub = 0xFF;    // Until a sub-device secondary address follows
+#endif
+      secPending = isSecExpected();
+      atnstat |= 0x04;
+
+    } else if ( (db >= GC_TAD) && (db < GC_UNT) ) {
+      // Another device is addressed to talk
+      devTads = false;
+
+    } else if (db < GC_LAD) {
+      // Universal or addressed command
+      atnstat |= 0x08;
+      switch (db) {
+        case GC_SPE:
+          isSpoll = true;
+          break;
+        case GC_SPD:
+          isSpoll = false;
+          break;
+        case GC_DCL:
+          device_sdc_h();
+          break;
+        case GC_SDC:
+          if (devLads) device_sdc_h();
+          break;
+        case GC_GET:
+          if (devLads) device_get_h();
+          break;
+        case GC_TCT:
+          if (devTads) tctReceived = true;
+          break;
+#ifdef REMOTE_SIGNAL_PIN
+        case GC_LLO:
+          device_llo_h();
+          break;
+        case GC_GTL:
+          if (devLads) device_gtl_h();
+          break;
 #endif
-
-      }else if (db<0x20){
-        // Primary command received
-        gpibcmd = db;
-        if (gpibcmd == 0x18) isSpoll = true;
-        if (gpibcmd == 0x19) isSpoll = false;
-        atnstat |= 0x08;
       }
+    }
+    // Other secondary addresses and listen addresses are ignored
 
-    }   // End for
+  }
 
-  } // ATN bytes processed
+  // ATN read loop completed
+  atnstat |= 0x01;
 
-  
-  /***** If we have not been adressed then back to idle and exit loop *****/
-  if (!addressed) {
+  // Extended addressing but secondary address not received
+  if (secPending && (gpibBus.cfg.saddr != 0xFF)) {
+    devLads = false;
+    devTads = false;
+  }
+
+  /***** Promiscuous mode *****/
+  // Don't process anything, just listen and repeat to USB
+  if (isProm) {
+    device_listen_h();
     gpibBus.setControls(DINI);
-#ifdef DEBUG_DEVICE_ATN
-    showATNStatus(atnstat, ustat, cmdbyteslist, listbytecnt);
-#endif
     return;
   }
 
-  /***** If addressed, then perform the appropriate actions *****/
-  if (addressed) {
-
-    // Serial poll requested progress?
-    if (!gpibcmd && isSpoll) {
-      gpibcmd = 0x18;
-      isSpoll = false;
-    }
-
-    // If we have a primary GPIB command then execute it
-    if (gpibcmd) {
-      // Respond to GPIB command
-      execGpibCmd(gpibcmd);
-      // Clear flags
-      gpibcmd = 0;
-      atnstat |= 0x20;
+  /***** Take control *****/
+  if (tctReceived) {
+    devUnaddress();
+    device_tct_h();
+    atnstat |= 0x20;
 #ifdef DEBUG_DEVICE_ATN
-      showATNStatus(atnstat, ustat, cmdbyteslist, listbytecnt);
+    showATNStatus(atnstat, bytecnt);
 #endif
-      return;      
-    }
+    return;
+  }
 
-#ifdef EN_STORAGE
-    // If we have a secondary address then perform secondary GPIB command actions *****/
-    if (addressed && saddrcmd) {
-      // Execute the GPIB secondary addressing command
-      storage.storeExecCmd(saddrcmd);
-      // Clear secondary address command
-      saddrcmd = 0;
-      atnstat |= 0x40;
-  #ifdef DEBUG_DEVICE_ATN
-      showATNStatus(atnstat, ustat, cmdbyteslist, listbytecnt, rstat);
-  #endif
-      return;
-    }
+  /***** Serial poll in progress and addressed to talk *****/
+  if (devTads && isSpoll) {
+    device_spe_h();
+    atnstat |= 0x20;
+#ifdef DEBUG_DEVICE_ATN
+    showATNStatus(atnstat, bytecnt);
 #endif
+    return;
+  }
 
-    // If no GPIB commands but addressed to listen then just listen
-    if (gpibBus.isDeviceAddressedToListen()) {
-      device_listen_h();
-      atnstat |= 0x80;
-      gpibBus.setControls(DIDS);
+  /***** Addressed to listen so receive data *****/
+  if (devLads) {
+    gpibBus.setControls(DLAS);
+    device_listen_h();
+    atnstat |= 0x80;
+    gpibBus.setControls(DIDS);
 #ifdef DEBUG_DEVICE_ATN
-      DB_PRINT(F("Listen done."),"");
-      showATNStatus(atnstat, ustat, cmdbyteslist, listbytecnt);
+    DB_PRINT(F("Listen done."),"");
+    showATNStatus(atnstat, bytecnt);
 #endif
-      return;
-    }
-  
-    // If no GPIB commands but addressed to talk then send data
-    if (gpibBus.isDeviceAddressedToTalk()) {
-      device_talk_h();
-      atnstat |= 0x80;
-      gpibBus.setControls(DIDS);
+    return;
+  }
+
+  /***** Addressed to talk so send data *****/
+  if (devTads) {
+    gpibBus.setControls(DTAS);
+    device_talk_h();
+    atnstat |= 0x80;
+    gpibBus.setControls(DIDS);
 #ifdef DEBUG_DEVICE_ATN
-      DB_PRINT(F("Talk done."),"");
-      showATNStatus(atnstat, ustat, cmdbyteslist, listbytecnt);
+    DB_PRINT(F("Talk done."),"");
+    showATNStatus(atnstat, bytecnt);
 #endif
-      return;
-    }
-
+    return;
   }
 
+  /***** Not addressed so back to idle *****/
+  gpibBus.setControls(DINI);
 #ifdef DEBUG_DEVICE_ATN
-  DB_PRINT(F("ATN: Nothing to process!"),"");
-  showATNStatus(atnstat, ustat, cmdbyteslist, listbytecnt);
+  showATNStatus(atnstat, bytecnt);
 #endif
 
 }
 
 
-#ifdef DEBUG_DEVICE_ATN
-void showATNStatus(uint8_t atnstat, uint8_t ustat, uint8_t atnbytes[], size_t bcnt) {
+/***** Secondary address may follow MLA/MTA? *****/
+bool isSecExpected() {
+#ifdef DEVICE_SUBADDR
+  if (subMask) return true;
+#endif
+  return (gpibBus.cfg.saddr != 0xFF);
+}
 
-  if (ustat & 0x01) DB_PRINT(F("unlistened."),"");
-  if (ustat & 0x02) DB_PRINT(F("untalked."),"");
+
+#ifdef DEBUG_DEVICE_ATN
+void showATNStatus(uint8_t atnstat, uint8_t bcnt) {
 
   if (atnstat & 0x01) DB_PRINT(F("ATN read loop completed."),"");
   if (atnstat & 0x02) DB_PRINT(F("addressed to LISTEN."),"");
   if (atnstat & 0x04) DB_PRINT(F("addressed to TALK."),"");
   if (atnstat & 0x08) DB_PRINT(F("primary command received."),"");
-  if (atnstat & 0x10) DB_PRINT(F("secondary command received."),"");
+  if (atnstat & 0x10) DB_PRINT(F("secondary address received."),"");
   if (atnstat & 0x20) DB_PRINT(F("primary command done."),"");
-  if (atnstat & 0x40) DB_PRINT(F("secondary command done."),"");
   if (atnstat & 0x80) DB_PRINT(F("data transfer done."),"");
 
-  DB_HEXA_PRINT(F("ATN bytes received: "), atnbytes, bcnt);
   DB_PRINT(bcnt,F(" ATN bytes read."));
-//  DB_PRINT(F("Error status: "),rstat);
 
   DB_PRINT(F("END attnReceived.\n\n"),"");
 
@@ -3232,6 +4257,36 @@ void execGpibCmd(uint8_t gpibcmd){
 
 /***** Device is addressed to listen - so listen *****/
 void device_listen_h(){
+#ifdef DEVICE_SUBADDR
+  // Tag data for a sub-device with its number
+  if (devSub != 0xFF) {
+    dataPort.print(devSub);
+    dataPort.print(':');
+    gpibBus.receiveData(dataPort, false, false, 0x0);
+    return;
+  }
+#endif
+#ifdef DEVICE_RESP_TABLE
+  // Hold the query back until checked against the response table
+  if (respTbl[0]) {
+    char qstr[RESP_QUERY_LEN];
+    BUFSTREAM qbuf(qstr, RESP_QUERY_LEN);
+    // Data too long to be a table query goes straight to the host
+    qbuf.setOverflow(&dataPort);
+    gpibBus.receiveData(qbuf, false, false, 0x0);
+    if (qbuf.isOverflowed()) {
+      respMisses++;
+    } else if (qbuf.length() > 0) {
+      if (respServe(qstr, qbuf.length())) {
+        dataPort.print(qstr);
+        respMisses++;
+      } else {
+        respHits++;
+      }
+    }
+    return;
+  }
+#endif
   // Receivedata params: stream, detectEOI, detectEndByte, endByte
   gpibBus.receiveData(dataPort, false, false, 0x0);
 }
@@ -3239,6 +4294,17 @@ void device_listen_h(){
 
 /***** Device is addressed to talk - so send data *****/
 void device_talk_h(){
+#ifdef DEVICE_SUBADDR
+  // Sub-devices only send what has been queued for them
+  if (devSub != 0xFF) {
+    tqSend(devSub);
+    return;
+  }
+#endif
+#ifdef DEVICE_TALK_QUEUE
+  // Send a response queued in advance
+  if (tqSend(TQ_PRIMARY) == OK) return;
+#endif
   DB_PRINT("LnRdy: ", lnRdy);
   DB_PRINT("Buffer: ", pBuf);
   if (lnRdy == 2) gpibBus.sendData(pBuf, pbPtr);
@@ -3254,15 +4320,39 @@ void device_sdc_h() {
   #ifdef DEBUG_DEVICE_ATN
     DB_PRINT(F("SDC requested..."),"");
   #endif
+#ifdef DEVICE_SUBADDR
+  // Clear only the addressed sub-device
+  if (devSub != 0xFF) {
+    while (tqDiscard(devSub) == OK);
+    subStat[devSub] = 0;
+    subSrqUpdate();
+    return;
+  }
+#endif
   if (isVerb) dataPort.println(F("Clearing..."));
   flushPbuf();
   lnRdy = 0;
+#ifdef DEVICE_TALK_QUEUE
+  tqClear();
+#endif
   gpibBus.cfg.stat = 0;
   gpibBus.clearSignal(SRQ_BIT);
+#ifdef DEVICE_SUBADDR
+  memset(subStat, 0, sizeof(subStat));
+#endif
   if (isVerb) dataPort.println(F("Done."));
 }
 
 
+/***** Group Execute Trigger *****/
+void device_get_h() {
+#ifdef DEBUG_DEVICE_ATN
+  DB_PRINT(F("GET received."),"");
+#endif
+  if (isVerb) dataPort.println(F("Trigger received."));
+}
+
+
 /***** Serial Poll Disable Request *****/
 void device_spd_h() {
 #ifdef DEBUG_DEVICE_ATN
@@ -3274,14 +4364,39 @@ void device_spd_h() {
 
 /***** Serial Poll Enable Request *****/
 void device_spe_h() {
+  uint8_t stat = spollStatus();
 #ifdef DEBUG_DEVICE_ATN
-  uint8_t stat = gpibBus.cfg.stat;
   DB_PRINT(F("Serial poll request received from controller ->"),"");
 #endif
-  // Send the status byte
-  gpibBus.sendStatus();
+  // Send the status byte (RQS is only cleared once it has been read)
+  if (gpibBus.spollRespond(stat)) spollDone();
 #ifdef DEBUG_DEVICE_ATN
-  DB_PRINT(F("Status sent: "), (stat & ~0x40));
+  DB_PRINT(F("Status sent: "), stat);
+#endif
+}
+
+
+/***** Status byte to return when serial polled *****/
+uint8_t spollStatus() {
+#ifdef DEVICE_SUBADDR
+  if (devSub != 0xFF) return subStat[devSub];
+#endif
+  return gpibBus.cfg.stat;
+}
+
+
+/***** Status byte has been read so clear RQS *****/
+void spollDone() {
+#ifdef DEVICE_SUBADDR
+  if (devSub != 0xFF) {
+    subStat[devSub] &= ~0x40;
+  } else {
+    gpibBus.setStatus(gpibBus.cfg.stat & ~0x40);
+  }
+  // Sub-devices may still be requesting service
+  subSrqUpdate();
+#else
+  gpibBus.setStatus(gpibBus.cfg.stat & ~0x40);
 #endif
 }
 
@@ -3342,17 +4457,100 @@ void device_gtl_h(){
 
 void lonMode(){
 
+  uint8_t buf[LONBSIZE];
+  size_t n;
+  size_t start;
+  uint8_t blocks = 0;
+  uint8_t rterm = (lonSplit == 1) ? ';' : 0x0C;
+
+  // Set bus for device listner active mode
+  gpibBus.setControls(DLAS);
+
+  while (isRO) {
+
+    // Read as much as the bus will deliver and send it on in one write
+    n = gpibBus.readBlock(buf, LONBSIZE, LONIDLE);
+    if (n) {
+      if (lonSplit) {
+        // Start a new line after each record
+        start = 0;
+        for (size_t i=0; i<n; i++) {
+          if (buf[i] == rterm) {
+            dataPort.write(&buf[start], i + 1 - start);
+            dataPort.println();
+            start = i + 1;
+          }
+        }
+        if (start < n) dataPort.write(&buf[start], n - start);
+      } else {
+        dataPort.write(buf, n);
+      }
+      // Keep reading while data is arriving, checking for commands every 16 blocks
+      if ( (n == LONBSIZE) && (++blocks & 0x0F) ) continue;
+    }
+
+    // Check whether there are charaters waiting in the serial input buffer and call handler
+    if (dataPort.available()) {
+
+      lnRdy = serialIn_h();
+
+      // We have a command so return to main loop and execute it
+      if (lnRdy==1) break;
+
+      // Clear the buffer to prevent it getting blocked
+      if (lnRdy==2) flushPbuf();
+
+    }
+
+  }
+
+  // Set bus to idle
+  gpibBus.setControls(DIDS);
+
+}
+
+
+#ifdef USE_CAPTURE
+/***** Bus capture mode *****/
+/*
+ * Records are buffered while bytes are arriving and sent to the host
+ * in frames once no byte has arrived for CAPIDLE microseconds or when
+ * the buffer fills. While the buffer is full NRFD stays asserted so the
+ * talker waits.
+ */
+void captureMode(){
+
   uint8_t db = 0;
+  uint8_t flags = 0;
   enum gpibHandshakeState state;
-  bool eoiDetected = false;
 
   // Set bus for device listner active mode
   gpibBus.setControls(DLAS);
 
-  while (isRO) {
+  while (isCapt) {
 
-    state = gpibBus.readByte(&db, false, &eoiDetected);
-    if (state == HANDSHAKE_COMPLETE) dataPort.write(db);
+    if (gpibCapture.isFull()) {
+      gpibCapture.sendFrame(dataPort);
+      continue;
+    }
+
+    state = gpibBus.captureByte(&db, &flags, CAPIDLE);
+    if (state == HANDSHAKE_COMPLETE) {
+      gpibCapture.add(db, flags);
+      continue;
+    }
+
+    // Bus has been quiet for CAPIDLE so send what we have
+    if (gpibCapture.available()) {
+      while (gpibCapture.available()) gpibCapture.sendFrame(dataPort);
+      continue;
+    }
+
+    // Stop condition met and everything sent
+    if (gpibCapture.isStopped()) {
+      isCapt = false;
+      break;
+    }
 
     // Check whether there are charaters waiting in the serial input buffer and call handler
     if (dataPort.available()) {
@@ -3369,51 +4567,127 @@ void lonMode(){
 
   }
 
+  // Send anything left
+  while (gpibCapture.available()) gpibCapture.sendFrame(dataPort);
+  if (!isCapt) gpibCapture.sendEnd(dataPort);
+
   // Set bus to idle
   gpibBus.setControls(DIDS);
 
 }
+#endif
 
 
 /***** Talk only mpode *****/
+/*
+ * After a failed write (no listener or listener timeout) data is dropped
+ * until a listener asserts NDAC, so that each block does not wait for
+ * the full read timeout.
+ */
 void tonMode(){
 
+  uint8_t buf[TONBSIZE];
+  size_t n;
+  int16_t held = -1;    // Last byte held back for EOI when idle
+  unsigned long lastRx = millis();
+  bool wrErr = false;   // Last write failed
+
   // Set bus for device taker active mode
   gpibBus.setControls(DTAS);
 
   while (isTO>0) {
 
-    // Check whether there are charaters waiting in the serial input buffer and call handler
-    if (dataPort.available()) {
-
-      if (isTO == 1) {
-        // Unbuffered version
-        gpibBus.writeByte(dataPort.read(), false);
+    if (isTO == 1) {
+      // Unbuffered version - take whatever is in the serial receive buffer
+      n = 0;
+      while ( (n < TONBSIZE) && dataPort.available() ) {
+        buf[n++] = dataPort.read();
+      }
+      if (n) {
+        if (!wrErr || gpibBus.isAsserted(NDAC_PIN)) wrErr = tonWrite(buf, n, false, held);
+        lastRx = millis();
+        continue;
       }
+    }
 
-      if (isTO == 2) {
-        
-        // Buffered version
-        lnRdy = serialIn_h();
+    if ( (isTO == 2) && dataPort.available() ) {
 
-        // We have a command return to main loop and execute it
-        if (lnRdy==1) break;
+      // Buffered version
+      lnRdy = serialIn_h();
 
-        // Otherwise send the buffered data
-        if (lnRdy==2) {
-          for (uint8_t i=0; i<pbPtr; i++){
-            gpibBus.writeByte(pBuf[i], false);  // False = No EOI
-          }
-          flushPbuf();
-        }
-        
+      // We have a command return to main loop and execute it
+      if (lnRdy==1) break;
+
+      // Otherwise send the buffered data
+      if (lnRdy==2) {
+        if (!wrErr || gpibBus.isAsserted(NDAC_PIN)) wrErr = tonWrite((uint8_t *)pBuf, pbPtr, true, held);
+        flushPbuf();
+        lastRx = millis();
       }
+      continue;
+    }
 
+    // No more data so send the held byte with EOI
+    if ( (held >= 0) && ((unsigned long)(millis() - lastRx) >= TONIDLE) ) {
+      uint8_t db = held;
+      if (!wrErr || gpibBus.isAsserted(NDAC_PIN)) wrErr = (gpibBus.writeBlock(&db, 1, WITH_EOI) != HANDSHAKE_COMPLETE);
+      held = -1;
     }
 
   }
 
+  if ( (held >= 0) && (!wrErr || gpibBus.isAsserted(NDAC_PIN)) ) {
+    uint8_t db = held;
+    gpibBus.writeBlock(&db, 1, WITH_EOI);
+  }
+
   // Set bus to idle
   gpibBus.setControls(DIDS);
 
 }
+
+
+/***** Send talk only data with EOI placed as configured *****/
+/*
+ * isLine: data is a complete line from the parse buffer
+ * held: byte held back until idle (-1 = none)
+ * Returns ERR and drops the rest of the data if a write fails. Without a
+ * terminator (eos 3) EOI is only sent at the end of a line.
+ */
+bool tonWrite(uint8_t *data, size_t n, bool isLine, int16_t &held) {
+  uint8_t term = (gpibBus.cfg.eos == 1) ? CR : LF;
+  size_t start = 0;
+
+  if (n == 0) return OK;
+
+  switch (tonEoi) {
+    case 1:
+      // EOI at the end of each line or with the terminator
+      if (isLine) {
+        return (gpibBus.writeBlock(data, n, WITH_EOI) != HANDSHAKE_COMPLETE);
+      }
+      if (gpibBus.cfg.eos != 3) {
+        for (size_t i=0; i<n; i++) {
+          if (data[i] == term) {
+            if (gpibBus.writeBlock(&data[start], i + 1 - start, WITH_EOI) != HANDSHAKE_COMPLETE) return ERR;
+            start = i + 1;
+          }
+        }
+      }
+      if (start < n) return (gpibBus.writeBlock(&data[start], n - start, NO_EOI) != HANDSHAKE_COMPLETE);
+      break;
+    case 2:
+      // Hold back the last byte until there is no more data
+      if (held >= 0) {
+        uint8_t db = held;
+        held = -1;
+        if (gpibBus.writeBlock(&db, 1, NO_EOI) != HANDSHAKE_COMPLETE) return ERR;
+      }
+      if (gpibBus.writeBlock(data, n - 1, NO_EOI) != HANDSHAKE_COMPLETE) return ERR;
+      held = data[n - 1];
+      break;
+    default:
+      return (gpibBus.writeBlock(data, n, NO_EOI) != HANDSHAKE_COMPLETE);
+  }
+  return OK;
+}
@@ -0,0 +1,215 @@
+#include <Arduino.h>
+#include "AR488_Config.h"
+#include "AR488_Capture.h"
+
+/***** AR488_Capture.cpp, ver. 0.01.01, 18/10/2026 *****/
+
+
+#ifdef USE_CAPTURE
+
+/****** Process status values *****/
+#define OK false
+#define ERR true
+
+
+/********** PUBLIC FUNCTIONS **********/
+
+/***** Class constructor *****/
+GPIBcapture::GPIBcapture() {
+  trigType = CAP_TRIG_NONE;
+  trigAddr = 0;
+  trigPatLen = 0;
+  preTrig = 0;
+  stopCount = 0;
+  stopOnEoi = false;
+  filterMask = 0;
+  start();
+}
+
+
+/***** Empty the buffer, restart the timestamp and arm the trigger *****/
+void GPIBcapture::start() {
+  head = 0;
+  cnt = 0;
+  total = 0;
+  postCnt = 0;
+  lastMicros = micros();
+  triggered = (trigType == CAP_TRIG_NONE);
+  stopped = false;
+  talker = 0xFF;
+  listeners = 0;
+  memset(history, 0, CAP_PAT_LEN);
+}
+
+
+/***** Set the trigger condition *****/
+void GPIBcapture::setTrigger(uint8_t type, uint8_t addr) {
+  trigType = type;
+  trigAddr = addr;
+}
+
+
+/***** Set a data trigger pattern *****/
+bool GPIBcapture::setPattern(const char *pattern, uint8_t plen) {
+  if ( (plen == 0) || (plen > CAP_PAT_LEN) ) return ERR;
+  memcpy(trigPat, pattern, plen);
+  trigPatLen = plen;
+  trigType = CAP_TRIG_DATA;
+  return OK;
+}
+
+
+/***** Set the number of records kept from before the trigger *****/
+void GPIBcapture::setPreTrigger(uint16_t recs) {
+  preTrig = (recs < CAPTURE_SIZE) ? recs : (CAPTURE_SIZE - 1);
+}
+
+
+/***** Add a record to the buffer *****/
+/*
+ * Returns ERR if the buffer is full
+ */
+bool GPIBcapture::add(uint8_t db, uint8_t flags) {
+  unsigned long now = micros();
+  unsigned long delta = now - lastMicros;
+  uint8_t *rec;
+
+  if (stopped) return OK;
+
+  // Check trigger condition (also updates talker/listener state)
+  if (isTrigger(db, flags)) triggered = true;
+
+  if (isFiltered(db, flags)) return OK;
+
+  if (!triggered) {
+    // Keep only the last preTrig records
+    if (preTrig == 0) return OK;
+    if (cnt >= preTrig) {
+      head = (head + 1) % CAPTURE_SIZE;
+      cnt--;
+    }
+  } else {
+    if (cnt >= CAPTURE_SIZE) return ERR;
+    postCnt++;
+    if ( (stopCount > 0) && (postCnt >= stopCount) ) stopped = true;
+    if ( stopOnEoi && ((flags & (CAP_ATN | CAP_EOI)) == CAP_EOI) ) stopped = true;
+  }
+
+  // Long gaps are recorded in milliseconds
+  if (delta > 0xFFFF) {
+    delta = delta / 1000;
+    if (delta > 0xFFFF) delta = 0xFFFF;
+    flags |= CAP_MSEC;
+  }
+  lastMicros = now;
+
+  rec = &buf[((head + cnt) % CAPTURE_SIZE) * CAP_REC_SIZE];
+  rec[0] = flags;
+  rec[1] = delta & 0xFF;
+  rec[2] = (delta >> 8) & 0xFF;
+  rec[3] = db;
+  cnt++;
+  total++;
+  return OK;
+}
+
+
+/***** Send up to CAP_FRAME_RECS records as a binary frame *****/
+void GPIBcapture::sendFrame(Stream &dataStream) {
+  uint8_t n = (available() < CAP_FRAME_RECS) ? available() : CAP_FRAME_RECS;
+  uint8_t hdr[3] = { CAP_SYNC1, CAP_SYNC2, n };
+  uint8_t chk = 0;
+  uint8_t *rec;
+
+  if (n == 0) return;
+
+  dataStream.write(hdr, 3);
+  for (uint8_t i=0; i<n; i++) {
+    rec = &buf[head * CAP_REC_SIZE];
+    for (uint8_t j=0; j<CAP_REC_SIZE; j++) chk ^= rec[j];
+    dataStream.write(rec, CAP_REC_SIZE);
+    head = (head + 1) % CAPTURE_SIZE;
+    cnt--;
+  }
+  dataStream.write(chk);
+}
+
+
+/***** Send the end of capture frame *****/
+void GPIBcapture::sendEnd(Stream &dataStream) {
+  uint8_t frm[4] = { CAP_SYNC1, CAP_SYNC2, 0, 0 };
+  dataStream.write(frm, 4);
+}
+
+
+bool GPIBcapture::isFull() {
+  return (cnt >= CAPTURE_SIZE);
+}
+
+
+/***** Records ready to send (none until triggered) *****/
+uint16_t GPIBcapture::available() {
+  return triggered ? cnt : 0;
+}
+
+
+bool GPIBcapture::isTriggered() {
+  return triggered;
+}
+
+
+bool GPIBcapture::isStopped() {
+  return stopped;
+}
+
+
+
+/********** PRIVATE FUNCTIONS **********/
+
+/***** Track addressing and check for the trigger condition *****/
+bool GPIBcapture::isTrigger(uint8_t db, uint8_t flags) {
+  if (flags & CAP_ATN) {
+    db &= 0x7F;
+    if (db == 0x3F) {
+      listeners = 0;
+    } else if (db == 0x5F) {
+      talker = 0xFF;
+    } else if ( (db >= 0x20) && (db < 0x3F) ) {
+      listeners |= (1UL << (db - 0x20));
+      if ( (trigType == CAP_TRIG_LAD) && ((db - 0x20) == trigAddr) ) return true;
+    } else if ( (db >= 0x40) && (db < 0x5F) ) {
+      talker = db - 0x40;
+      if ( (trigType == CAP_TRIG_TAD) && (talker == trigAddr) ) return true;
+    }
+    return false;
+  }
+
+  // Data byte
+  if (trigType == CAP_TRIG_DATA) {
+    memmove(history, history + 1, CAP_PAT_LEN - 1);
+    history[CAP_PAT_LEN - 1] = db;
+    if (memcmp(history + CAP_PAT_LEN - trigPatLen, trigPat, trigPatLen) == 0) return true;
+  }
+  return false;
+}
+
+
+/***** Check whether a byte is excluded by the address filter *****/
+bool GPIBcapture::isFiltered(uint8_t db, uint8_t flags) {
+  if (filterMask == 0) return false;
+
+  if (flags & CAP_ATN) {
+    db &= 0x7F;
+    // Addressing of other devices
+    if ( (db >= 0x20) && (db < 0x3F) ) return !(filterMask & (1UL << (db - 0x20)));
+    if ( (db >= 0x40) && (db < 0x5F) ) return !(filterMask & (1UL << (db - 0x40)));
+    return false;
+  }
+
+  // Data to or from a selected device
+  if ( (talker != 0xFF) && (filterMask & (1UL << talker)) ) return false;
+  if (listeners & filterMask) return false;
+  return true;
+}
+
+#endif  // USE_CAPTURE
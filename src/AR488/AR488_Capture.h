@@ -0,0 +1,103 @@
+#ifndef AR488_CAPTURE_H
+#define AR488_CAPTURE_H
+
+#include <Arduino.h>
+#include "AR488_Config.h"
+
+
+/***** AR488_Capture.h, ver. 0.01.01, 18/10/2026 *****/
+
+
+#ifdef USE_CAPTURE
+
+/*
+ * Capture record (4 bytes):
+ *   flags   : bit 0 = ATN, bit 1 = EOI, bit 2 = SRQ,
+ *             bit 6 = delta is in milliseconds rather than microseconds
+ *   delta   : time since previous record (16 bits, little endian)
+ *   data    : data byte
+ *
+ * Frame sent to the host:
+ *   0xA5 0x5A <count> <count records> <XOR of record bytes>
+ * A frame with a count of zero marks the end of the capture.
+ *
+ * Capture starts when the trigger condition is met. Up to preTrig
+ * records seen before the trigger are kept and sent with the rest.
+ * Capture ends after stopCount records or on a data byte sent with
+ * EOI if set. When filterMask is set only traffic to or from those
+ * primary addresses (and other commands) is recorded.
+ */
+
+#define CAP_ATN 0x01
+#define CAP_EOI 0x02
+#define CAP_SRQ 0x04
+#define CAP_MSEC 0x40
+
+#define CAP_REC_SIZE 4
+#define CAP_SYNC1 0xA5
+#define CAP_SYNC2 0x5A
+#define CAP_FRAME_RECS 16
+#define CAP_PAT_LEN 8
+
+// Trigger conditions
+#define CAP_TRIG_NONE 0
+#define CAP_TRIG_TAD 1
+#define CAP_TRIG_LAD 2
+#define CAP_TRIG_DATA 3
+
+
+class GPIBcapture {
+
+  public:
+
+    GPIBcapture();
+
+    void start();
+    bool add(uint8_t db, uint8_t flags);
+    void sendFrame(Stream &dataStream);
+    void sendEnd(Stream &dataStream);
+
+    bool isFull();
+    uint16_t available();
+    bool isTriggered();
+    bool isStopped();
+
+    void setTrigger(uint8_t type, uint8_t addr);
+    bool setPattern(const char *pattern, uint8_t plen);
+    void setPreTrigger(uint16_t recs);
+
+    uint32_t total;         // Records captured since start
+
+    uint32_t stopCount;     // Stop after this many records (0 = no limit)
+    bool stopOnEoi;         // Stop on data byte with EOI
+    uint32_t filterMask;    // Primary addresses to record (0 = all)
+
+  private:
+
+    bool isTrigger(uint8_t db, uint8_t flags);
+    bool isFiltered(uint8_t db, uint8_t flags);
+
+    uint8_t buf[CAPTURE_SIZE * CAP_REC_SIZE];
+    uint16_t head;          // Oldest record
+    uint16_t cnt;           // Records held
+    unsigned long lastMicros;
+
+    uint8_t trigType;
+    uint8_t trigAddr;
+    uint8_t trigPat[CAP_PAT_LEN];
+    uint8_t trigPatLen;
+    uint8_t history[CAP_PAT_LEN];   // Most recent data bytes
+    uint16_t preTrig;
+
+    bool triggered;
+    bool stopped;
+    uint32_t postCnt;       // Records since trigger
+
+    uint8_t talker;         // Current talker (0xFF = none)
+    uint32_t listeners;     // Current listeners
+
+};
+
+#endif  // USE_CAPTURE
+
+#endif  // AR488_CAPTURE_H
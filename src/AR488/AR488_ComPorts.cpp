@@ -56,6 +56,90 @@ int DEVNULL::lastByte()
 }
 
 
+/***** Stream into a character buffer *****/
+
+BUFSTREAM::BUFSTREAM(char *buf, size_t bsize)
+{
+  setTimeout(0);
+  _buf = buf;
+  _bsize = bsize;
+  clear();
+}
+
+int BUFSTREAM::available()
+{
+  return _len - _rpos;
+}
+
+int BUFSTREAM::peek()
+{
+  if (_rpos < _len) return (uint8_t)_buf[_rpos];
+  return EOF;
+}
+
+int BUFSTREAM::read()
+{
+  if (_rpos < _len) return (uint8_t)_buf[_rpos++];
+  return EOF;
+}
+
+void BUFSTREAM::flush()
+{
+  return;
+}
+
+size_t BUFSTREAM::write(const uint8_t data)
+{
+  // Passing data through to the overflow stream
+  if (_spilled) return _ovf->write(data);
+  // Keep room for the terminating NULL
+  if ((_len + 1) >= _bsize) {
+    if (_ovf == NULL) return 0;
+    // Buffer full so hand everything over to the overflow stream
+    _ovf->write((const uint8_t *)_buf, _len);
+    _spilled = true;
+    return _ovf->write(data);
+  }
+  _buf[_len++] = data;
+  _buf[_len] = '\0';
+  return 1;
+}
+
+size_t BUFSTREAM::write( const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while ((n < size) && write(buffer[n])) n++;
+  return n;
+}
+
+size_t BUFSTREAM::length()
+{
+  return _len;
+}
+
+void BUFSTREAM::clear()
+{
+  _len = 0;
+  _rpos = 0;
+  _spilled = false;
+  if (_bsize) _buf[0] = '\0';
+}
+
+/*
+ * When set, data that does not fit in the buffer is passed through to
+ * ostream, preceded by the buffer contents, rather than being dropped
+ */
+void BUFSTREAM::setOverflow(Stream *ostream)
+{
+  _ovf = ostream;
+}
+
+bool BUFSTREAM::isOverflowed()
+{
+  return _spilled;
+}
+
+
 
 /***************************************/
 /***** Serial Port implementations *****/
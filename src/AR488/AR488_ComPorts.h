@@ -34,6 +34,44 @@ private:
 };
 
 
+/***** Stream into a character buffer *****/
+/*
+ * Collects output (e.g. from GPIBbus::receiveData) into a fixed size
+ * buffer. The buffer is kept NULL terminated. Characters written can be
+ * read back in order. Excess characters are discarded unless an overflow
+ * stream has been set with setOverflow(): when the buffer fills, its
+ * contents and everything written after are passed on to that stream.
+ */
+
+class BUFSTREAM : public Stream
+{
+public:
+  BUFSTREAM(char *buf, size_t bsize);
+
+  int    available();
+  int    peek();
+  int    read();
+  void   flush();
+
+  size_t write(const uint8_t data);
+  size_t write( const uint8_t *buffer, size_t size);
+
+  size_t length();
+  void   clear();
+
+  void   setOverflow(Stream *ostream);
+  bool   isOverflowed();
+
+private:
+  char *  _buf;
+  size_t  _bsize;
+  size_t  _len;
+  size_t  _rpos;
+  Stream * _ovf = NULL;
+  bool    _spilled = false;
+};
+
+
 /*
  * Serial Port definition
  */
@@ -29,6 +29,15 @@
 /*
  * Configure the appropriate board/layout section
  * below as required
+ *
+ * The ESP32 and RP2040 layouts generate their data bus and control line
+ * code from the pin numbers (GpioBank8 in AR488_Layouts.h). The AVR layouts
+ * are out of scope for that generator and keep hand-written port register
+ * code: UNO/NANO, 328PB_ALT, MEGA32U4_MICRO/LR3, MEGA2560_D/E1/E2,
+ * MEGA644P_MCGRAW, POE_ETHERNET_GPIB_ADAPTOR (4809) and MCP23S17. When
+ * moving a pin on one of these, change the register code of the layout to
+ * match and run src/test/host/run.sh, which checks it against the pin
+ * numbers (all but the MCP23S17).
  */
 #if defined(AR488_CUSTOM)
   /* Board layout */
@@ -187,6 +196,7 @@
   #define MCP_ADDRESS   0
   #define MCP_SELECTPIN 10
   #define MCP_INTERRUPT 2
+  #define MCP_SPI_CLOCK 10000000
 #endif
 
 
@@ -247,6 +257,123 @@
 //#define SAY_HELLO
 
 
+/***** Device mode talker output queue (++talkq) *****/
+/*
+ * Responses queued by the host in advance are sent from RAM as soon
+ * as the interface is addressed to talk in device mode.
+ */
+//#define DEVICE_TALK_QUEUE
+
+
+/***** Device mode query/response table (++resp) *****/
+/*
+ * Queries received from the controller that match an entry in the
+ * table are answered by the interface. Unmatched queries are passed
+ * to the host as usual. Requires the talker output queue.
+ */
+//#define DEVICE_RESP_TABLE
+#ifdef DEVICE_RESP_TABLE
+  #define RESP_TABLE_SIZE 126   // Bytes, EEPROM area 128-255 less CRC
+  #define RESP_QUERY_LEN 48
+  #ifndef DEVICE_TALK_QUEUE
+    #define DEVICE_TALK_QUEUE
+  #endif
+#endif
+
+
+
+/***** Device mode sub-devices (++subdev) *****/
+/*
+ * Secondary addresses 0-30 of the interface can be enabled as separate
+ * devices, each with its own output queue (++talkq sub) and status
+ * byte. Data received by a sub-device is sent to the host prefixed
+ * with its number and a colon. Requires the talker output queue.
+ */
+//#define DEVICE_SUBADDR
+#if defined(DEVICE_SUBADDR) && !defined(DEVICE_TALK_QUEUE)
+  #define DEVICE_TALK_QUEUE
+#endif
+
+#ifdef DEVICE_TALK_QUEUE
+  #define TALKQ_SIZE 128
+#endif
+
+
+/***** Device mode ATN interrupt *****/
+/*
+ * Acknowledge ATN from an interrupt handler in device mode. NRFD and
+ * NDAC are asserted as soon as the controller asserts ATN instead of
+ * when the main loop next checks the ATN line. ATN_PIN must support
+ * interrupts. Not available with the MCP23S17.
+ */
+//#define DEVICE_ATN_INTERRUPT
+#if defined(DEVICE_ATN_INTERRUPT) && defined(AR488_MCP23S17)
+  #undef DEVICE_ATN_INTERRUPT
+#endif
+
+
+/***** Bus capture (++capture) *****/
+/*
+ * Records every byte handshaken on the bus, including ATN commands,
+ * with a timestamp and the ATN/EOI/SRQ state in a RAM ring buffer and
+ * streams the records to the host in binary frames. Uses CAPTURE_SIZE
+ * * 4 bytes. When the buffer is full the bus is held off until it has
+ * been drained, so no bytes are lost.
+ */
+//#define USE_CAPTURE
+#ifdef USE_CAPTURE
+  #define CAPTURE_SIZE 64
+#endif
+
+
+/***** Instrument inventory (++inv) *****/
+/*
+ * Keeps the address and the *IDN? reply of instruments found on the
+ * bus in RAM. Uses INVENTORY_SIZE * (INVENTORY_IDN_LEN + 3) bytes.
+ */
+//#define USE_INVENTORY
+#ifdef USE_INVENTORY
+  #define INVENTORY_SIZE 8
+  #define INVENTORY_IDN_LEN 48
+#endif
+
+
+/***** RP2040 dual core GPIB engine *****/
+/*
+ * RP2040 boards only. In controller mode the handshake of receiveData is
+ * run on core 1 while core 0 writes the received data to the host port.
+ * Core 0 waits for the receive to finish, so commands are not parsed in
+ * the meantime. Data is passed to core 0 through a lock-free ring buffer
+ * of DUALCORE_RING_SIZE bytes (power of 2). Sends, and all transfers in
+ * device mode (ATN interrupt, device state machine), stay on core 0.
+ */
+//#define PICO_DUAL_CORE
+#if defined(PICO_DUAL_CORE) && !defined(ARDUINO_ARCH_RP2040)
+  #undef PICO_DUAL_CORE
+#endif
+#ifdef PICO_DUAL_CORE
+  #define DUALCORE_RING_SIZE 1024
+#endif
+
+
+/***** RP2040 PIO handshake *****/
+/*
+ * RAS_PICO layouts only. In controller mode the DAV/NRFD/NDAC handshake
+ * of data transfers runs in PIO state machines. Outgoing bytes are fed to
+ * the source state machine by DMA. The data settling time before DAV is
+ * the send settle time (settle_s_time), as in the CPU handshake, but is
+ * never shorter than 32 system clock cycles. Device mode keeps the CPU
+ * handshake.
+ */
+//#define PICO_PIO_HANDSHAKE
+#if defined(PICO_PIO_HANDSHAKE) && !defined(RAS_PICO_L1) && !defined(RAS_PICO_L2)
+  #undef PICO_PIO_HANDSHAKE
+#endif
+#ifdef PICO_PIO_HANDSHAKE
+  #define PIO_TXBUF_SIZE 64
+#endif
+
+
 /***** DEBUG LEVEL OPTIONS *****/
 /*
  * Configure debug level options
@@ -0,0 +1,127 @@
+#include <Arduino.h>
+#include "AR488_Config.h"
+#include "AR488_DualCore.h"
+
+/***** AR488_DualCore.cpp, ver. 0.01.01, 18/10/2026 *****/
+
+
+#ifdef PICO_DUAL_CORE
+
+extern GPIBbus gpibBus;
+
+/***** Mailbox *****/
+enum dcJobState {
+  DC_IDLE,
+  DC_POSTED,
+  DC_DONE
+};
+
+struct dcJob {
+  bool detectEoi;
+  bool detectEndByte;
+  uint8_t endByte;
+  size_t maxSize;
+  enum receiveState rstate;
+};
+
+dcJob dcMbox;
+volatile uint8_t dcState = DC_IDLE;
+
+SPSCRING<DUALCORE_RING_SIZE> dcRxRing;
+RINGSTREAM dcRxStream(dcRxRing);
+
+
+/********** RINGSTREAM **********/
+
+RINGSTREAM::RINGSTREAM(SPSCRING<DUALCORE_RING_SIZE> &ring) : _ring(ring) {
+}
+
+int RINGSTREAM::available() {
+  return 0;
+}
+
+int RINGSTREAM::peek() {
+  return -1;
+}
+
+int RINGSTREAM::read() {
+  return -1;
+}
+
+void RINGSTREAM::flush() {
+}
+
+/***** Push a byte, waiting while core 0 drains a full ring *****/
+size_t RINGSTREAM::write(const uint8_t data) {
+  while (!_ring.push(data)) {};
+  return 1;
+}
+
+size_t RINGSTREAM::write(const uint8_t *buffer, size_t size) {
+  for (size_t i=0; i<size; i++) {
+    write(buffer[i]);
+  }
+  return size;
+}
+
+
+/********** CORE 0 **********/
+
+/***** Running on core 1? *****/
+bool dcIsCore1() {
+  return (rp2040.cpuid() == 1);
+}
+
+
+/***** Post the mailbox job to core 1 *****/
+void dcPost() {
+  __sync_synchronize();
+  dcState = DC_POSTED;
+}
+
+
+/***** Drain the receive ring into a stream *****/
+void dcDrain(Stream &dataStream) {
+  uint8_t chunk[64];
+  uint8_t n = 0;
+  while ( (n < sizeof(chunk)) && dcRxRing.pop(chunk[n]) ) n++;
+  if (n) dataStream.write(chunk, n);
+}
+
+
+/***** Receive on core 1, forwarding data to dataStream as it arrives *****/
+enum receiveState dcReceiveData(Stream &dataStream, bool detectEoi, bool detectEndByte, uint8_t endByte, size_t maxSize) {
+  dcMbox.detectEoi = detectEoi;
+  dcMbox.detectEndByte = detectEndByte;
+  dcMbox.endByte = endByte;
+  dcMbox.maxSize = maxSize;
+  dcPost();
+  while (dcState != DC_DONE) {
+    dcDrain(dataStream);
+  }
+  __sync_synchronize();
+  // All data was in the ring before the job was marked done
+  while (dcRxRing.available()) {
+    dcDrain(dataStream);
+  }
+  dcState = DC_IDLE;
+  return dcMbox.rstate;
+}
+
+
+/********** CORE 1 **********/
+
+void setup1() {
+}
+
+
+/***** Run a posted receive *****/
+void loop1() {
+  if (dcState != DC_POSTED) return;
+  __sync_synchronize();
+  dcMbox.rstate = gpibBus.receiveData(dcRxStream, dcMbox.detectEoi, dcMbox.detectEndByte, dcMbox.endByte, dcMbox.maxSize);
+  __sync_synchronize();
+  dcState = DC_DONE;
+}
+
+#endif  // PICO_DUAL_CORE
@@ -0,0 +1,89 @@
+#ifndef AR488_DUALCORE_H
+#define AR488_DUALCORE_H
+
+#include <Arduino.h>
+#include "AR488_Config.h"
+#include "AR488_GPIBbus.h"
+
+
+/***** AR488_DualCore.h, ver. 0.01.01, 18/10/2026 *****/
+
+
+#ifdef PICO_DUAL_CORE
+
+/*
+ * Core 1 runs the handshake of controller mode receives. Core 0 posts a
+ * job to a single-slot mailbox and owns nothing on the bus until core 1
+ * marks the job done. Bytes received from the bus are returned through an
+ * SPSC ring that core 0 drains into the caller's stream while the
+ * handshake continues on core 1. Core 0 does nothing else meanwhile:
+ * the overlap is between bus handshake and host port writes only.
+ *
+ * Mailbox states: DC_IDLE -> DC_POSTED (core 0) -> DC_DONE (core 1) -> DC_IDLE (core 0)
+ */
+
+
+/***** Single producer, single consumer byte ring *****/
+/*
+ * One core pushes, the other pops. Each index is written by one side
+ * only, with a memory barrier between the data access and the index update.
+ */
+template <uint16_t RSIZE>
+class SPSCRING {
+public:
+  bool push(uint8_t db) {
+    uint16_t h = _head;
+    if ((uint16_t)(h - _tail) >= RSIZE) return false;
+    _buf[h & (RSIZE - 1)] = db;
+    __sync_synchronize();
+    _head = h + 1;
+    return true;
+  }
+
+  bool pop(uint8_t &db) {
+    uint16_t t = _tail;
+    if (t == _head) return false;
+    __sync_synchronize();
+    db = _buf[t & (RSIZE - 1)];
+    __sync_synchronize();
+    _tail = t + 1;
+    return true;
+  }
+
+  uint16_t available() {
+    return (uint16_t)(_head - _tail);
+  }
+
+private:
+  static_assert((RSIZE & (RSIZE - 1)) == 0, "Ring size must be a power of 2");
+  uint8_t _buf[RSIZE];
+  volatile uint16_t _head = 0;
+  volatile uint16_t _tail = 0;
+};
+
+
+/***** Stream writing into the ring (core 1 side) *****/
+class RINGSTREAM : public Stream
+{
+public:
+  RINGSTREAM(SPSCRING<DUALCORE_RING_SIZE> &ring);
+
+  int    available();
+  int    peek();
+  int    read();
+  void   flush();
+
+  size_t write(const uint8_t data);
+  size_t write( const uint8_t *buffer, size_t size);
+
+private:
+  SPSCRING<DUALCORE_RING_SIZE> &_ring;
+};
+
+
+enum receiveState dcReceiveData(Stream &dataStream, bool detectEoi, bool detectEndByte, uint8_t endByte, size_t maxSize);
+bool dcIsCore1();
+
+#endif  // PICO_DUAL_CORE
+
+#endif  // AR488_DUALCORE_H
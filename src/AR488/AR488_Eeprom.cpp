@@ -101,6 +101,43 @@ bool epReadData(uint8_t cfgdata[], size_t cfgsize) {
 }
 
 
+/***** Write data to an EEPROM area (with CRC) *****/
+/*
+ * start = EEPROM address of the area. CRC16 is stored in the first two
+ * bytes followed by the data
+ * data = data to write
+ * dsize = size of data
+ */
+void epWriteArea(uint16_t start, uint8_t data[], size_t dsize) {
+  uint16_t crc;
+
+  // Write data
+  for (size_t i=0; i<dsize; i++){
+    EEPROM.update(start+2+i, data[i]);
+  }
+  // Write CRC
+  crc = getCRC16(data, dsize);
+  EEPROM.put(start, crc);
+}
+
+
+/***** Read data from an EEPROM area (with CRC check) *****/
+bool epReadArea(uint16_t start, uint8_t data[], size_t dsize) {
+  uint16_t crc1;
+  uint16_t crc2;
+
+  // Read CRC
+  EEPROM.get(start, crc1);
+  // Read data
+  for (size_t i=0; i<dsize; i++){
+    data[i] = EEPROM.read(start+2+i);
+  }
+  // Get CRC of data
+  crc2 = getCRC16(data, dsize);
+  return (crc1==crc2);
+}
+
+
 bool isEepromClear(){
   int16_t crc = 0;
 
@@ -215,6 +252,51 @@ bool epReadData(uint8_t cfgdata[], size_t cfgsize) {
 }
 
 
+/***** Write data to an EEPROM area (with CRC) *****/
+/*
+ * start = EEPROM address of the area. CRC16 is stored in the first two
+ * bytes followed by the data
+ * data = data to write
+ * dsize = size of data
+ */
+void epWriteArea(uint16_t start, uint8_t data[], size_t dsize) {
+  uint16_t crc;
+
+  // Load EEPROM data from Flash
+  EEPROM.begin(EESIZE);
+  // Write data
+  for (size_t i=0; i<dsize; i++) {
+    EEPROM.write(start+2+i, data[i]);
+  }
+  // Write CRC
+  crc = getCRC16(data, dsize);
+  EEPROM.put(start, crc);
+  // Commit write to Flash
+  EEPROM.commit();
+  EEPROM.end();
+}
+
+
+/***** Read data from an EEPROM area (with CRC check) *****/
+bool epReadArea(uint16_t start, uint8_t data[], size_t dsize) {
+  uint16_t crc1;
+  uint16_t crc2;
+
+  // Load EEPROM data from Flash
+  EEPROM.begin(EESIZE);
+  // Read CRC
+  EEPROM.get(start, crc1);
+  // Read data
+  for (size_t i=0; i<dsize; i++) {
+    data[i] = EEPROM.read(start+2+i);
+  }
+  EEPROM.end();
+  // Get CRC of data
+  crc2 = getCRC16(data, dsize);
+  return (crc1==crc2);
+}
+
+
 bool isEepromClear(){
   int16_t crc = 0;
 
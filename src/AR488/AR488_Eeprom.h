@@ -31,6 +31,7 @@
 #define EESIZE 256
 #define EESTART 2    // EEPROM start of data - min 4 for CRC32, min 2 for CRC16
 #define UPCASE true
+#define EERESP 128   // EEPROM start of device mode response table area (CRC16 + data)
 
 
 const uint16_t eesize = EESIZE;
@@ -45,6 +46,8 @@ void epErase();
 void epWriteData(uint8_t cfgdata[], size_t cfgsize);
 bool epReadData(uint8_t cfgdata[], size_t cfgsize);
 void epViewData(Stream& outputStream);
+void epWriteArea(uint16_t start, uint8_t data[], size_t dsize);
+bool epReadArea(uint16_t start, uint8_t data[], size_t dsize);
 bool isEepromClear();
 
 
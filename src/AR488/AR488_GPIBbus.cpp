@@ -2,6 +2,12 @@
 //#include <SD.h>
 #include "AR488_Config.h"
 #include "AR488_GPIBbus.h"
+#ifdef PICO_DUAL_CORE
+  #include "AR488_DualCore.h"
+#endif
+#ifdef PICO_PIO_HANDSHAKE
+  #include "AR488_Pio.h"
+#endif
 
 /***** AR488_GPIB.cpp, ver. 0.53.23, 05/08/2025 *****/
 
@@ -29,8 +35,11 @@
 GPIBbus::GPIBbus() {
   // Default configuration values
   setDefaultCfg();
+  clearBusMap();
   cstate = 0;
   deviceAddressed = TONONE;
+  settle_r_time = 0;
+  settle_s_time = 1;  // Data setup time before DAV (us)
 }
 
 
@@ -39,6 +48,9 @@ void GPIBbus::begin() {
 #if defined(RAS_PICO_L1) || defined(RAS_PICO_L2) 
   initRpGpioPins();
 #endif
+#if defined(AR488_CUSTOM) || defined(NON_ARDUINO)
+  initGpibPins();
+#endif
 //gpioFuncList();
 #ifdef LEVEL_SHIFTER
   initLevelShifter();
@@ -54,6 +66,7 @@ void GPIBbus::begin() {
 
 /***** Stops active mode and bring control and data bus to inactive state *****/
 void GPIBbus::stop() {
+  disableAtnInterrupt();
   cstate = 0;
   // Set control bus to idle state (all lines input_pullup)
 //Serial.println(F("Clear all signals to input pullup"));
@@ -92,6 +105,8 @@ void GPIBbus::startDeviceMode() {
   // Enable level shifter
   shiftEnable(true);
 #endif
+  // Respond to ATN without waiting for the main loop
+  enableAtnInterrupt();
 }
 
 
@@ -121,6 +136,7 @@ void GPIBbus::startControllerMode() {
 /***** Set the interface mode *****/
 void GPIBbus::setOperatingMode(enum operatingMode mode) {
   uint8_t outputs = 0;
+  ctrlSynced = false;
   switch (mode) {
     case OP_IDLE:
       setGpibCtrlDir(0, CTRL_BITS);             // Set all control signals to input_pullup
@@ -143,6 +159,7 @@ void GPIBbus::setOperatingMode(enum operatingMode mode) {
 /***** Set the transmission mode *****/
 void GPIBbus::setTransmitMode(enum transmitMode mode) {
   uint8_t outputs = 0;
+  ctrlSynced = false;
   switch (mode) {
         case TM_CTRL_IDLE:
       outputs = (DAV_BIT | EOI_BIT);          // Signal DAV and EOI, listen to NRFD and NDAC
@@ -182,6 +199,7 @@ void GPIBbus::setTransmitMode(enum transmitMode mode) {
 /***** Assert an individual or group of signals *****/
 void GPIBbus::assertSignal(uint8_t sig) {
   // Note: GPIO pin direction assumed set by setOperatingMode()
+  ctrlSynced = false;
   setGpibCtrlState(0, sig);   // Set all signals permitted by mask to LOW (asserted)
 }
 
@@ -189,12 +207,14 @@ void GPIBbus::assertSignal(uint8_t sig) {
 /***** Clear (unassert) an individual or group of signals *****/
 void GPIBbus::clearSignal(uint8_t sig) {
   // Note: GPIO pin direction assumed set by setOperatingMode()
+  ctrlSynced = false;
   setGpibCtrlState(sig, sig);   // Set all signals permitted by mask to HIGH (unasserted)
 }
 
 
 /***** Clear all GPIB control signals *****/
 void GPIBbus::clearAllSignals() {
+  ctrlSynced = false;
   setGpibCtrlDir(0, ALL_BITS);            // Set all control signal pins to input_pullup
 }
 
@@ -209,34 +229,51 @@ bool GPIBbus::isController() {
 /***** Detect selected pin state *****/
 bool GPIBbus::isAsserted(uint8_t gpibsig) {
 #ifdef AR488_MCP23S17 
-  uint8_t mcpPinAssertedReg = 0;
-  mcpPinAssertedReg = ~getMcpIntAReg();
-  return (mcpPinAssertedReg & (1 << gpibsig));
+  // Cached expander state, refreshed from INTCAPA/GPIOA on INTA
+  return (getGpibPinState(gpibsig) == LOW);
 #else
   // Use digitalRead function to get current Arduino pin state
   return (digitalRead(gpibsig) == LOW) ? true : false;
 #endif
-  if (getGpibPinState(gpibsig) == LOW) return true;
-  return false;
 }
 
 
-/***** Send the device status byte *****/
-void GPIBbus::sendStatus() {
-  // Have been addressed and polled so send the status byte
-  if (!(cstate == DTAS)) setControls(DTAS);
-  writeByte(cfg.stat, NO_EOI);
-  setControls(DIDS);
-  // Clear the SRQ bit
-  cfg.stat = cfg.stat & ~0x40;
-  // De-assert the SRQ signal
-  clearSignal(SRQ_BIT);
+/***** Answer a serial poll as soon as ATN is released *****/
+/*
+ * Called once addressed to talk with serial poll enabled. The status
+ * byte is prepared by the caller so that it can be sent the moment ATN
+ * goes high. NRFD is released while waiting so that the controller can
+ * still send more command bytes. Returns false without sending if a
+ * command byte arrives first or on timeout, and also when the status
+ * byte handshake does not complete.
+ */
+bool GPIBbus::spollRespond(uint8_t statusByte) {
+  unsigned long startMillis = millis();
+  enum gpibHandshakeState gpibState;
+
+  if (isAsserted(ATN_PIN)) {
+    // Ready for further command bytes
+    clearSignal(NRFD_BIT);
+    while (isAsserted(ATN_PIN)) {
+      if (getGpibPinState(DAV_PIN) == LOW) return false;
+      if ((unsigned long)(millis() - startMillis) >= cfg.rtmo) return false;
+    }
+  }
+
+  setControls(DTAS);
+  gpibState = handshakeByte(statusByte, false);
+  // On ATN or IFC handshakeByte() has already set DLAS
+  if (cstate == DTAS) setControls(DIDS);
+  return (gpibState == HANDSHAKE_COMPLETE);
 }
 
 
 /***** Set the status byte *****/
 void GPIBbus::setStatus(uint8_t statusByte) {
   cfg.stat = statusByte;
+#ifdef DEVICE_ATN_INTERRUPT
+  noInterrupts();
+#endif
   if (statusByte & 0x40) {
     // If SRQ bit is set then assert the SRQ signal
     assertSignal(SRQ_BIT);
@@ -244,6 +281,9 @@ void GPIBbus::setStatus(uint8_t statusByte) {
     // If SRQ bit is NOT set then de-assert the SRQ signal
     clearSignal(SRQ_BIT);
   }
+#ifdef DEVICE_ATN_INTERRUPT
+  interrupts();
+#endif
 }
 
 
@@ -254,6 +294,8 @@ void GPIBbus::sendIFC() {
   delayMicroseconds(150);
   // De-assert IFC
   clearSignal(IFC_BIT);
+  // Devices may have changed
+  clearBusMap();
 }
 
 
@@ -385,6 +427,42 @@ bool GPIBbus::sendGET(uint8_t addr) {
 }
 
 
+/***** Send a single GET (trigger) to a group of devices *****/
+/*
+ * All devices are addressed to listen before the GET is sent so
+ * that they are triggered at the same moment.
+ */
+bool GPIBbus::sendGroupGET(uint8_t pris[], uint8_t secs[], uint8_t cnt) {
+#ifdef DEBUG_GPIB_COMMANDS
+  DB_PRINT(F("sending group GET..."), "");
+#endif
+  if (addressListeners(pris, secs, cnt)) {
+#ifdef DEBUG_GPIB_COMMANDS
+    DB_PRINT(F("failed to address the devices."), "");
+#endif
+    return ERR;
+  }
+  // Send GET
+  if (sendCmd(GC_GET)) {
+#ifdef DEBUG_GPIB_COMMANDS
+    DB_PRINT(F("failed to send GET to devices"), "");
+#endif
+    return ERR;
+  }
+  // Unlisten bus
+  if (unAddressDevice()) {
+#ifdef DEBUG_GPIB_COMMANDS
+    DB_PRINT(F("failed to unlisten the GPIB bus"), "");
+#endif
+    return ERR;
+  }
+#ifdef DEBUG_GPIB_COMMANDS
+  DB_PRINT(F("done."), "");
+#endif
+  return OK;
+}
+
+
 /***** Send a TCT (Take Control) command *****/
 bool GPIBbus::sendTCT(uint8_t addr){
  #ifdef DEBUG_GPIB_COMMANDS
@@ -537,6 +615,12 @@ bool GPIBbus::sendCmd(uint8_t cmdByte) {
  */
 enum receiveState GPIBbus::receiveData(Stream &dataStream, bool detectEoi, bool detectEndByte, uint8_t endByte, size_t maxSize) {
 
+#ifdef PICO_DUAL_CORE
+  // Controller mode: handshake on core 1 while core 0 forwards the data.
+  // Device mode stays on core 0 with the ATN interrupt and device state.
+  if (!dcIsCore1() && (cfg.cmode == 2)) return dcReceiveData(dataStream, detectEoi, detectEndByte, endByte, maxSize);
+#endif
+
   uint8_t bytes[3] = { 0 };  // Received byte buffer
   uint8_t eor = cfg.eor & 7;
   size_t x = 0;
@@ -599,6 +683,15 @@ enum receiveState GPIBbus::receiveData(Stream &dataStream, bool detectEoi, bool
   // Ready the data bus
   readyGpibDbus();
 
+#ifdef PICO_PIO_HANDSHAKE
+  // Controller mode: acceptor handshake in PIO. When reading to EOI with
+  // no size limit, bytes may be accepted ahead of the loop below.
+  if (cfg.cmode == 2) {
+    pioAcceptStart(readWithEoi && (maxSize == 0));
+    pioRx = true;
+  }
+#endif
+
   // Perform read of data (r=0: data read OK; r>0: GPIB read error);
   while (hstate == HANDSHAKE_COMPLETE) {
 
@@ -677,6 +770,13 @@ enum receiveState GPIBbus::receiveData(Stream &dataStream, bool detectEoi, bool
     }
   }
 
+#ifdef PICO_PIO_HANDSHAKE
+  if (pioRx) {
+    pioAcceptStop();
+    pioRx = false;
+  }
+#endif
+
 #ifdef DEBUG_GPIBbus_RECEIVE
   DB_RAW_PRINTLN();
   DB_PRINT(F("After loop flags:"), "");
@@ -732,6 +832,7 @@ enum receiveState GPIBbus::receiveData(Stream &dataStream, bool detectEoi, bool
 
 /***** Send a series of characters as data to the GPIB bus *****/
 void GPIBbus::sendData(const char *data, uint8_t dsize, bool isLastPacket) {
+
   //  bool err = false;
   uint8_t tc;
   enum gpibHandshakeState state;
@@ -754,6 +855,14 @@ void GPIBbus::sendData(const char *data, uint8_t dsize, bool isLastPacket) {
     setControls(DTAS);
   }
 
+#ifdef PICO_PIO_HANDSHAKE
+  // Controller mode: source handshake in PIO, bytes are queued for DMA
+  if (cfg.cmode == 2) {
+    pioSourceStart(settle_s_time);
+    pioTx = true;
+  }
+#endif
+
 #ifdef DEBUG_GPIBbus_SEND
   DB_PRINT(F("write data mode is set."), "");
   DB_PRINT(F("Begin send loop ->"), "");
@@ -783,7 +892,7 @@ void GPIBbus::sendData(const char *data, uint8_t dsize, bool isLastPacket) {
     DB_RAW_PRINT(data[i]);
 #endif
 
-    if (state != HANDSHAKE_COMPLETE) break;
+    if ((state != HANDSHAKE_COMPLETE) && (state != DATA_QUEUED)) break;
   }
 
 #ifdef DEBUG_GPIBbus_SEND
@@ -791,7 +900,7 @@ void GPIBbus::sendData(const char *data, uint8_t dsize, bool isLastPacket) {
 #endif
 
   // Terminators and EOI
-  if ((state == HANDSHAKE_COMPLETE) && tc) {
+  if (((state == HANDSHAKE_COMPLETE) || (state == DATA_QUEUED)) && tc) {
     switch (cfg.eos) {
       case 1:
         writeByte(CR, cfg.eoi);
@@ -816,6 +925,19 @@ void GPIBbus::sendData(const char *data, uint8_t dsize, bool isLastPacket) {
     }
   }
 
+#ifdef PICO_PIO_HANDSHAKE
+  // Wait for the queued bytes to be accepted
+  if (pioTx) {
+    if (state == DATA_QUEUED) state = pioFlush();
+    pioSourceStop();
+    pioTx = false;
+  }
+#endif
+
+#ifdef DEBUG_GPIBbus_SEND
+  if (state != HANDSHAKE_COMPLETE) DB_PRINT(F("Send failed, handshake state: "), state);
+#endif
+
   // If final packet of transmission then go to idle
   if (isLastPacket) {
     if (cfg.cmode == 2) {  // Controller mode
@@ -832,6 +954,81 @@ void GPIBbus::sendData(const char *data, uint8_t dsize, bool isLastPacket) {
 
 
 
+/***** Wait for a talker to listener transfer to complete *****/
+/*
+ * Used once a talker and its listeners have been addressed. The
+ * controller releases ATN and is an active acceptor: it drives NRFD and
+ * NDAC for every byte like any other listener, so the talker is paced by
+ * the controller as well, but the data is not forwarded. Returns the end
+ * reason: EOI or terminator, RECEIVE_ERR on timeout if the talker stops,
+ * or RECEIVE_BREAK if interrupted.
+ */
+enum receiveState GPIBbus::waitTransfer(bool detectEoi, bool detectEndByte, uint8_t endByte) {
+
+  uint8_t bytes[3] = { 0 };  // Received byte buffer
+  uint8_t eor = cfg.eor & 7;
+  bool readWithEoi = false;
+  bool eoiDetected = false;
+  enum gpibHandshakeState hstate;
+  enum receiveState rstate = RECEIVE_INIT;
+
+  // Reset transmission break flag
+  txBreak = false;
+
+  // EOI detection required ?
+  if (cfg.eoi || detectEoi || (cfg.eor == 7)) readWithEoi = true;
+
+  // Release ATN and take part in the handshake as an acceptor
+  setControls(CLAS);
+  readyGpibDbus();
+
+#ifdef DEBUG_GPIBbus_RECEIVE
+  DB_PRINT(F("Standing by for transfer ->"), "");
+#endif
+
+  while (rstate == RECEIVE_INIT) {
+
+    if (txBreak) {
+      rstate = RECEIVE_BREAK;
+      break;
+    }
+
+    // Accept the next byte (times out after cfg.rtmo)
+    hstate = readByte(&bytes[0], readWithEoi, &eoiDetected);
+    if (hstate != HANDSHAKE_COMPLETE) {
+      rstate = RECEIVE_ERR;
+      break;
+    }
+
+#ifdef DEBUG_GPIBbus_RECEIVE
+    DB_HEX_PRINT(bytes[0]);
+#endif
+
+    if (readWithEoi) {
+      if (eoiDetected) rstate = RECEIVE_EOI;
+    } else if (detectEndByte) {
+      if (bytes[0] == endByte) rstate = RECEIVE_ENDCHAR;
+    } else {
+      if (isTerminatorDetected(bytes, eor)) rstate = RECEIVE_ENDL;
+    }
+
+    // Shift last three bytes in memory
+    bytes[2] = bytes[1];
+    bytes[1] = bytes[0];
+  }
+
+#ifdef DEBUG_GPIBbus_RECEIVE
+  DB_PRINT(F("<- End of transfer: "), rstate);
+#endif
+
+  // Reset break flag
+  if (txBreak) txBreak = false;
+
+  setControls(CIDS);
+  return rstate;
+}
+
+
 /**************************************************/
 /***** FUCTIONS TO READ/WRITE DATA TO STORAGE *****/
 /***** vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv *****/
@@ -853,6 +1050,54 @@ void GPIBbus::signalBreak() {
 }
 
 
+/***** Control line settings for each GPIB state *****/
+/*
+ * One entry per state (CINI..DTAS). Control bits as setGpibCtrlDir and
+ * setGpibCtrlState: 7-ATN, 6-SRQ, 5-REN, 4-EOI, 3-DAV, 2-NRFD, 1-NDAC, 0-IFC
+ *   dirMask/dir     : lines to set, 0=input_pullup, 1=output
+ *   stateMask/state : lines to set, 0=LOW (asserted), 1=HIGH
+ *   flags           : SN7516X transceiver levels and data bus handling
+ * Lines outside both masks (e.g. REN, SRQ and IFC in the idle/transfer
+ * states) are left as they are.
+ */
+#define CS_TE_HIGH     0x01  // SN7516X TE high (talk)
+#define CS_DBUS_READY  0x02  // Data bus to input_pullup
+#define CS_CTRL_INIT   0x04  // SN7516X DC low, SC high
+#define CS_DEVI_INIT   0x08  // SN7516X DC high, SC low
+
+struct ctrlStateEntry {
+  uint8_t dirMask;
+  uint8_t dir;
+  uint8_t stateMask;
+  uint8_t state;
+  uint8_t flags;
+};
+
+static const ctrlStateEntry ctrlStateTable[] PROGMEM = {
+  // CINI: controller init - IFC, REN, ATN, DAV, EOI outputs, REN asserted
+  { ALL_BITS,  IFC_BIT | REN_BIT | ATN_BIT | DAV_BIT | EOI_BIT,
+               IFC_BIT | REN_BIT | ATN_BIT | DAV_BIT | EOI_BIT,  IFC_BIT | ATN_BIT | DAV_BIT | EOI_BIT,  CS_CTRL_INIT },
+  // CIDS: controller idle
+  { HSHK_BITS, DAV_BIT | EOI_BIT,    ATN_BIT | DAV_BIT | EOI_BIT,  ATN_BIT | DAV_BIT | EOI_BIT,  0 },
+  // CCMS: controller sending commands (ATN asserted)
+  { HSHK_BITS, DAV_BIT | EOI_BIT,    ATN_BIT | DAV_BIT | EOI_BIT,  DAV_BIT | EOI_BIT,  CS_TE_HIGH },
+  // CTAS: controller talker active
+  { HSHK_BITS, DAV_BIT | EOI_BIT,    ATN_BIT | DAV_BIT | EOI_BIT,  ATN_BIT | DAV_BIT | EOI_BIT,  CS_TE_HIGH },
+  // CLAS: controller listener active - NRFD, NDAC asserted
+  { HSHK_BITS, NRFD_BIT | NDAC_BIT,  ATN_BIT | NRFD_BIT | NDAC_BIT,  ATN_BIT,  0 },
+  // DINI: device init - SRQ output, everything else input_pullup
+  { ALL_BITS,  SRQ_BIT,              SRQ_BIT | REN_BIT,  SRQ_BIT | REN_BIT,  CS_TE_HIGH | CS_DEVI_INIT | CS_DBUS_READY },
+  // DIDS: device idle - handshake lines input_pullup
+  { HSHK_BITS, 0,                    0,  0,  CS_DBUS_READY },
+  // DLAS: device listener active - NRFD, NDAC asserted
+  { HSHK_BITS, NRFD_BIT | NDAC_BIT,  NRFD_BIT | NDAC_BIT,  0,  0 },
+  // DTAS: device talker active
+  { HSHK_BITS, DAV_BIT | EOI_BIT,    DAV_BIT | EOI_BIT,  DAV_BIT | EOI_BIT,  CS_TE_HIGH }
+};
+
+static_assert(sizeof(ctrlStateTable) / sizeof(ctrlStateTable[0]) == (DTAS - CINI + 1), "One table entry per GPIB state");
+
+
 /***** Control the GPIB bus - set various GPIB states *****/
 /*
  * state is a predefined state (CINI, CIDS, CCMS, CLAS, CTAS, DINI, DIDS, DLAS, DTAS);
@@ -862,157 +1107,85 @@ void GPIBbus::signalBreak() {
  * setGpibState byte3 (mode)     : 0=set pin state, 1=set pin direction
  */
 void GPIBbus::setControls(uint8_t state) {
-
-  // Switch state
-  switch (state) {
-
-    // Controller states
-    case CINI:  // Initialisation
-//    Serial.println(F("Set CINI OP_CTRL:"));
-      setOperatingMode(OP_CTRL);
-//      gpioFuncList();
-//    Serial.println(F("Set CINI TM_IDLE:"));
-      setTransmitMode(TM_CTRL_IDLE);
-//      gpioFuncList();
-//    Serial.println(F("Assert REN_BIT:"));
-      assertSignal(REN_BIT);
-//    gpioFuncList();
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, LOW);
-#ifdef SN7516X_DC
-      digitalWrite(SN7516X_DC, LOW);
-#endif
-#ifdef SN7516X_SC
-      digitalWrite(SN7516X_SC, HIGH);
-#endif
-#endif
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Initialised GPIB control mode"), "");
-#endif
-      break;
-
-
-    case CIDS:  // Controller idle state
-      setTransmitMode(TM_CTRL_IDLE);
-      clearSignal(ATN_BIT);
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, LOW);
-#endif
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines to idle state"), "");
-#endif
-      break;
-
-
-    case CCMS:  // Controller active - send commands
-      setTransmitMode(TM_SEND);
-      assertSignal(ATN_BIT);
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, HIGH);
-#endif
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines for sending a command"), "");
+#ifdef DEVICE_ATN_INTERRUPT
+  // Prevent the ATN interrupt handler changing lines part way through
+  noInterrupts();
+  applyControls(state);
+  interrupts();
+#else
+  applyControls(state);
 #endif
-      break;
+}
 
 
-    case CLAS:  // Controller - read data bus
-      // Set state for receiving data
-      setTransmitMode(TM_RECV);
-      clearSignal(ATN_BIT);
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, LOW);
-#endif
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines for reading data"), "");
-#endif
-      break;
+/***** Set the control lines for a GPIB state (see setControls) *****/
+/*
+ * Nothing to do if already in the state and no line has been changed
+ * since (ctrlSynced is cleared by assertSignal, clearSignal etc.).
+ */
+void GPIBbus::applyControls(uint8_t state) {
 
+  if ((state == cstate) && ctrlSynced) return;
 
-    case CTAS:  // Controller - write data bus
-      setTransmitMode(TM_SEND);
-      clearSignal(ATN_BIT);
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, HIGH);
-#endif
+  if ((state < CINI) || (state > DTAS)) {
 #ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines for writing data"), "");
+    // Should never get here!
+    DB_PRINT(F("Unknown GPIB state requested!"), "");
 #endif
-      break;
-
-
-    /* Bits control lines as follows: 8-ATN, 7-SRQ, 6-REN, 5-EOI, 4-DAV, 3-NRFD, 2-NDAC, 1-IFC */
-
-    // Listener states
-    case DINI:  // Listner initialisation
+    cstate = state;
+    ctrlSynced = false;
+    return;
+  }
 
+  const ctrlStateEntry *cse = &ctrlStateTable[state - CINI];
+  uint8_t flags = pgm_read_byte(&cse->flags);
 
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE, HIGH);
+  // Transceivers switch to talk before the lines are driven...
+  if (flags & CS_TE_HIGH) digitalWrite(SN7516X_TE, HIGH);
+  if (flags & CS_DEVI_INIT) {
 #ifdef SN7516X_DC
-      digitalWrite(SN7516X_DC, HIGH);
+    digitalWrite(SN7516X_DC, HIGH);
 #endif
 #ifdef SN7516X_SC
-      digitalWrite(SN7516X_SC, LOW);
+    digitalWrite(SN7516X_SC, LOW);
 #endif
+  }
 #endif
-      clearAllSignals();
-      setOperatingMode(OP_DEVI);  // Set up for device mode
-      // Set data bus to idle state
-      readyGpibDbus();
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Initialised GPIB listener mode"), "");
-#endif
-      break;
 
+  setGpibCtrlDir(pgm_read_byte(&cse->dir), pgm_read_byte(&cse->dirMask));
+  uint8_t stateMask = pgm_read_byte(&cse->stateMask);
+  if (stateMask) setGpibCtrlState(pgm_read_byte(&cse->state), stateMask);
 
-    case DIDS:  // Device idle state
 #ifdef SN7516X
-      digitalWrite(SN7516X_TE, HIGH);
-#endif
-      setTransmitMode(TM_DEVICE_IDLE);
-      // Set data bus to idle state
-      readyGpibDbus();
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines to idle state"), "");
+  // ...and back to listen once the lines have been released
+  if (!(flags & CS_TE_HIGH)) digitalWrite(SN7516X_TE, LOW);
+  if (flags & CS_CTRL_INIT) {
+#ifdef SN7516X_DC
+    digitalWrite(SN7516X_DC, LOW);
 #endif
-      break;
-
-
-    case DLAS:  // Device listner active (actively listening - can handshake)
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, LOW);
+#ifdef SN7516X_SC
+    digitalWrite(SN7516X_SC, HIGH);
 #endif
-      setTransmitMode(TM_RECV);
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines to idle state"), "");
+  }
 #endif
-      break;
 
+  // Set data bus to idle state
+  if (flags & CS_DBUS_READY) readyGpibDbus();
 
-    case DTAS:  // Device talker active (sending data)
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, HIGH);
-#endif
-      setTransmitMode(TM_SEND);
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines for listening as addresed device"), "");
-#endif
-      break;
 #ifdef DEBUG_GPIBbus_CONTROL
-    default:
-      // Should never get here!
-      DB_PRINT(F("Unknown GPIB state requested!"), "");
+  DB_PRINT(F("Set GPIB control state: "), state);
 #endif
-  }
 
   // Save state
   cstate = state;
+  ctrlSynced = true;
 }
 
 
 /***** Set GPIP control state using numeric input (xdiag_h) *****/
 void GPIBbus::setControlVal(uint8_t value) {
+  ctrlSynced = false;
   setGpibCtrlDir(0xFF, 0xFF); // Set all as outputs
   setGpibCtrlState(value, 0xFF);
 }
@@ -1020,6 +1193,7 @@ void GPIBbus::setControlVal(uint8_t value) {
 
 /***** Set GPIB data bus to specific value (xdiag_h) *****/
 void GPIBbus::setDataVal(uint8_t value) {
+  ctrlSynced = false;
   setGpibDbus(value);
 }
 
@@ -1082,6 +1256,168 @@ bool GPIBbus::addressDevice(uint8_t pri, uint8_t sec=0xFF, uint8_t dir=TOLISTEN)
 }
 
 
+/***** Send data to a device at a primary and secondary address *****/
+/*
+ * saddr is 0x60-0x7E, or 0xFF for none. The device is addressed and
+ * the data sent in one operation and the device is left addressed to
+ * listen.
+ */
+bool GPIBbus::sendSecondaryCmd(uint8_t paddr, uint8_t saddr, char * data, uint8_t dsize) {
+  if (addressDevice(paddr, saddr, TOLISTEN)) return ERR;
+  sendData(data, dsize);
+  return OK;
+}
+
+
+/***** Unlisten bus then address a group of devices to listen *****/
+/*
+ * All devices are addressed in a single command sequence so that
+ * data or a command sent afterwards is received by all of them at
+ * once. secs may be NULL if no secondary addresses are required,
+ * otherwise each entry is 0x60-0x7E, or 0xFF for none.
+ */
+bool GPIBbus::addressListeners(uint8_t pris[], uint8_t secs[], uint8_t cnt) {
+
+  if (cnt == 0) return ERR;
+
+  // Check the whole list before touching the bus
+  for (uint8_t i=0; i<cnt; i++) {
+    if (pris[i]>30) return ERR;
+    if (secs && ( secs[i]<0x60 || (secs[i]>0x7E && secs[i]!=0xFF) )) return ERR;
+  }
+
+  if (sendCmd(GC_UNL)) return ERR;
+  if (sendCmd(GC_UNT)) return ERR;
+
+  for (uint8_t i=0; i<cnt; i++) {
+#ifdef DEBUG_GPIBbus_DEVICE
+    DB_PRINT(F("addressListeners: pri="), pris[i]);
+#endif
+    if (sendCmd(GC_LAD + pris[i])) return ERR;
+    // Secondary address?
+    if (secs && secs[i] != 0xFF) {
+      if (sendCmd(secs[i])) return ERR;
+    }
+  }
+
+  deviceAddressed = TOLISTEN;
+  return OK;
+}
+
+
+/***** Probe an address for a listener and record the result in the bus map *****/
+/*
+ * When withSec is set and no listener responds to the primary address,
+ * then secondary addresses are also checked. All 31 secondary addresses
+ * are sent in one sequence first so that each one only needs to be
+ * probed individually if an extended listener is present.
+ */
+bool GPIBbus::mapListener(uint8_t pri, bool withSec) {
+  uint32_t abit = (1UL << pri);
+  uint8_t j = 0;
+
+  if (pri>30) return ERR;
+
+  // Discard the previous result for this address
+  busMap.pri &= ~abit;
+  busMap.scanned &= ~abit;
+  busMap.swept &= ~abit;
+  busMap.trunc &= ~abit;
+  for (uint8_t i=0; i<busMap.scnt; i++) {
+    if (busMap.spri[i] != pri) {
+      busMap.spri[j] = busMap.spri[i];
+      busMap.ssec[j] = busMap.ssec[i];
+      j++;
+    }
+  }
+  busMap.scnt = j;
+
+  // Primary address
+  if (sendCmd(GC_UNL)) return ERR;
+  if (sendCmd(GC_LAD + pri)) return ERR;
+  if (probeNdac()) {
+    busMap.pri |= abit;
+  } else if (withSec) {
+    // Any secondary address
+    if (sendCmd(GC_UNL)) return ERR;
+    if (sendCmd(GC_LAD + pri)) return ERR;
+    for (uint8_t sec=0x60; sec<0x7F; sec++) {
+      if (sendCmd(sec)) return ERR;
+    }
+    if (probeNdac()) {
+      // Find which ones
+      for (uint8_t sec=0x60; sec<0x7F; sec++) {
+        if (sendCmd(GC_UNL)) return ERR;
+        if (sendCmd(GC_LAD + pri)) return ERR;
+        if (sendCmd(sec)) return ERR;
+        if (probeNdac()) {
+          if (busMap.scnt < BUSMAP_SEC_SIZE) {
+            busMap.spri[busMap.scnt] = pri;
+            busMap.ssec[busMap.scnt] = sec;
+            busMap.scnt++;
+          }else{
+            busMap.trunc |= abit;
+          }
+        }
+      }
+    }
+    busMap.swept |= abit;
+  }
+
+  busMap.scanned |= abit;
+  return OK;
+}
+
+
+/***** Release ATN and check whether a listener holds NDAC *****/
+/*
+ * Devices that have not been addressed to listen release NDAC as soon
+ * as ATN is unasserted, so an empty address returns within a few
+ * microseconds. Only a listener holds NDAC for the whole probe time.
+ */
+bool GPIBbus::probeNdac() {
+  unsigned long startMicros;
+
+  setControls(CIDS);
+  startMicros = micros();
+  while ((unsigned long)(micros() - startMicros) < PROBE_TIME_US) {
+    if (!isAsserted(NDAC_PIN)) return false;
+  }
+  return true;
+}
+
+
+/***** Clear the bus map *****/
+void GPIBbus::clearBusMap() {
+  busMap.scanned = 0;
+  busMap.pri = 0;
+  busMap.swept = 0;
+  busMap.trunc = 0;
+  busMap.scnt = 0;
+}
+
+
+/***** Check whether the bus map shows that there is no listener at an address *****/
+/*
+ * Only used to skip probes and for reporting, never to refuse addressing.
+ * Returns false unless the address has been scanned including a complete
+ * sweep of its secondary addresses. With no secondary address (0xFF), a
+ * device with only secondary addresses is present.
+ */
+bool GPIBbus::isListenerAbsent(uint8_t pri, uint8_t sec) {
+  uint32_t abit = (1UL << pri);
+
+  if (!(busMap.scanned & abit)) return false;
+  if (busMap.pri & abit) return false;
+  if (!(busMap.swept & abit)) return false;
+  if (busMap.trunc & abit) return false;
+  for (uint8_t i=0; i<busMap.scnt; i++) {
+    if ( (busMap.spri[i] == pri) && ((sec == 0xFF) || (busMap.ssec[i] == sec)) ) return false;
+  }
+  return true;
+}
+
+
 /***** Return status device addressing (Controller mode) *****/
 /*
  * true = device has been addressed; false = device has not been addressed
@@ -1091,6 +1427,70 @@ adressingDirection GPIBbus::haveAddressedDevice() {
 }
 
 
+/***** ATN interrupt (Device mode) *****/
+#ifndef IRAM_ATTR
+  #define IRAM_ATTR
+#endif
+
+#ifdef DEVICE_ATN_INTERRUPT
+
+static GPIBbus * atnBus = NULL;
+
+static void IRAM_ATTR atnIsr() {
+  if (atnBus) atnBus->atnAcknowledge();
+}
+
+#endif
+
+
+/***** Attach the ATN interrupt handler *****/
+void GPIBbus::enableAtnInterrupt() {
+#ifdef DEVICE_ATN_INTERRUPT
+  int irq = digitalPinToInterrupt(ATN_PIN);
+#ifdef NOT_AN_INTERRUPT
+  if (irq == NOT_AN_INTERRUPT) return;  // Main loop polls ATN instead
+#endif
+  atnPending = false;
+  atnBus = this;
+  attachInterrupt(irq, atnIsr, FALLING);
+  atnIntEnabled = true;
+#endif
+}
+
+
+/***** Detach the ATN interrupt handler *****/
+void GPIBbus::disableAtnInterrupt() {
+#ifdef DEVICE_ATN_INTERRUPT
+  if (atnIntEnabled) {
+    detachInterrupt(digitalPinToInterrupt(ATN_PIN));
+    atnIntEnabled = false;
+  }
+  atnPending = false;
+#endif
+}
+
+
+/***** Hold off the controller when ATN is asserted (called from interrupt) *****/
+/*
+ * When idle, NRFD and NDAC are asserted straight away so that the
+ * controller waits until attnRequired() reads the command bytes and sets
+ * DLAS. In any other state the handshake is already in progress and the
+ * main loop deals with ATN itself. Only the layout's holdGpibHandshake()
+ * is called: on ESP32 everything here must run from IRAM. cstate is left
+ * to the main loop, ctrlSynced is cleared so that the next setControls()
+ * is applied in full.
+ */
+void IRAM_ATTR GPIBbus::atnAcknowledge() {
+#ifdef DEVICE_ATN_INTERRUPT
+  if ((cstate == DIDS) || (cstate == DINI)) {
+    holdGpibHandshake();
+    ctrlSynced = false;
+    atnPending = true;
+  }
+#endif
+}
+
+
 /***** Device is addressed to listen? (Device mode) *****/
 bool GPIBbus::isDeviceAddressedToListen() {
   if (cstate == DLAS) return true;
@@ -1130,7 +1530,11 @@ enum gpibHandshakeState GPIBbus::readByte(uint8_t *db, bool readWithEoi, bool *e
   const unsigned long timeval = cfg.rtmo;
   enum gpibHandshakeState gpibState = HANDSHAKE_START;
 
-//  bool atnStat = isAsserted(ATN_PIN);  // Capture state of ATN
+#ifdef PICO_PIO_HANDSHAKE
+  if (pioRx) return pioReadByte(db, readWithEoi, eoi);
+#endif
+
+  bool atnStat = isAsserted(ATN_PIN);  // Capture state of ATN
   *eoi = false;
 
   // Wait for interval to expire
@@ -1146,14 +1550,9 @@ enum gpibHandshakeState GPIBbus::readByte(uint8_t *db, bool readWithEoi, bool *e
         break;
       }
 
-      // ATN unasserted during handshake - not ready yet so abort (and exit ATN loop)
-//      if (atnStat && !isAsserted(ATN_PIN)) {
-//        gpibState = ATN_ASSERTED;
-//        break;
-//      }
-
-      // ATN unasserted during handshake - not ready yet so abort (and exit ATN loop)
-      if (isAsserted(ATN_PIN)) {
+      // ATN asserted while reading data, or unasserted while reading
+      // commands (end of ATN loop), so abort
+      if (atnStat != isAsserted(ATN_PIN)) {
         gpibState = ATN_ASSERTED;
         break;
       }
@@ -1212,7 +1611,202 @@ enum gpibHandshakeState GPIBbus::readByte(uint8_t *db, bool readWithEoi, bool *e
 }
 
 
+/***** Accept a byte for bus capture *****/
+/*
+ * Returns HANDSHAKE_START when no byte has arrived for idleUs microseconds.
+ * Otherwise accepts the byte whether or not ATN is asserted and returns
+ * the ATN, EOI and SRQ state sampled with it in flags (bits 0, 1 and 2).
+ * NRFD stays asserted until the next call, so the talker is held off
+ * while the caller is busy. The bus must already be set to DLAS.
+ */
+enum gpibHandshakeState GPIBbus::captureByte(uint8_t *db, uint8_t *flags, uint16_t idleUs) {
+
+  unsigned long startMicros;
+  unsigned long startMillis;
+
+  // Ready for data
+  clearSignal(NRFD_BIT);
+
+  // Wait for DAV to go LOW
+  startMicros = micros();
+  while (getGpibPinState(DAV_PIN) == HIGH) {
+    if ((unsigned long)(micros() - startMicros) >= idleUs) return HANDSHAKE_START;
+  }
+
+  // Assert NRFD (Busy reading data)
+  assertSignal(NRFD_BIT);
+  *flags = 0;
+  if (isAsserted(ATN_PIN)) *flags |= 0x01;
+  if (isAsserted(EOI_PIN)) *flags |= 0x02;
+  if (isAsserted(SRQ_PIN)) *flags |= 0x04;
+  *db = readGpibDbus();
+  // Unassert NDAC signalling data accepted
+  clearSignal(NDAC_BIT);
+
+  // Wait for DAV to go HIGH indicating transfer complete
+  startMillis = millis();
+  while (getGpibPinState(DAV_PIN) == LOW) {
+    if ((unsigned long)(millis() - startMillis) >= cfg.rtmo) {
+      assertSignal(NDAC_BIT);
+      return DATA_ACCEPTED;
+    }
+  }
+  // Re-assert NDAC - ready to accept data again
+  assertSignal(NDAC_BIT);
+  return HANDSHAKE_COMPLETE;
+}
+
+
+/***** Read a block of data bytes *****/
+/*
+ * Reads until the buffer is full or no byte has arrived for idleUs
+ * microseconds. Bytes sent while ATN is asserted are accepted but not
+ * stored. Returns the number of bytes stored. NRFD is left asserted so
+ * the talker waits while the caller handles the data. If the talker
+ * holds DAV for longer than the read timeout after a byte, the bytes so
+ * far are returned and the next call waits for DAV to be released
+ * before reading on. The bus must already be set to DLAS.
+ */
+size_t GPIBbus::readBlock(uint8_t *buf, size_t bsize, uint16_t idleUs) {
+  size_t n = 0;
+  unsigned long startMicros;
+  unsigned long startMillis;
+  bool isCmd;
+
+  // Last byte of the previous call accepted but DAV still held
+  if (blockDavHeld) {
+    if (getGpibPinState(DAV_PIN) == LOW) return 0;
+    assertSignal(NDAC_BIT);
+    blockDavHeld = false;
+  }
+
+  while (n < bsize) {
+
+    // Ready for data
+    clearSignal(NRFD_BIT);
+
+    // Wait for DAV to go LOW
+    startMicros = micros();
+    while (getGpibPinState(DAV_PIN) == HIGH) {
+      if ((unsigned long)(micros() - startMicros) >= idleUs) {
+        assertSignal(NRFD_BIT);
+        return n;
+      }
+    }
+
+    // Assert NRFD (Busy reading data)
+    assertSignal(NRFD_BIT);
+    isCmd = isAsserted(ATN_PIN);
+    if (isCmd) {
+      readGpibDbus();
+    } else {
+      buf[n++] = readGpibDbus();
+    }
+    // Unassert NDAC signalling data accepted
+    clearSignal(NDAC_BIT);
+
+    // Wait for DAV to go HIGH indicating transfer complete
+    startMillis = millis();
+    while (getGpibPinState(DAV_PIN) == LOW) {
+      if ((unsigned long)(millis() - startMillis) >= cfg.rtmo) {
+        // Don't read the same byte again on the next pass
+        blockDavHeld = true;
+        return n;
+      }
+    }
+    // Re-assert NDAC
+    assertSignal(NDAC_BIT);
+  }
+
+  return n;
+}
+
+
+/***** Write a SINGLE BYTE of data to the GPIB bus using 3-way handshake *****/
+/*
+ * (- EOI is asserted with the byte if enabled and isLastByte is set )
+ * (- the GPIB bus must already be configured to talk               )
+ */
 enum gpibHandshakeState GPIBbus::writeByte(uint8_t db, bool isLastByte) {
+#ifdef PICO_PIO_HANDSHAKE
+  if (pioTx) return pioWriteByte(db, isLastByte);
+#endif
+  return handshakeByte(db, (cfg.eoi && isLastByte));
+}
+
+
+#ifdef PICO_PIO_HANDSHAKE
+/***** Read a byte accepted by the PIO acceptor *****/
+enum gpibHandshakeState GPIBbus::pioReadByte(uint8_t *db, bool readWithEoi, bool *eoi) {
+  unsigned long startMillis = millis();
+  bool eoiBit = false;
+
+  *eoi = false;
+  while (!pioAcceptByte(db, &eoiBit)) {
+    if ((unsigned long)(millis() - startMillis) >= cfg.rtmo) {
+#ifdef DEBUG_GPIBbus_RECEIVE
+      DB_PRINT(F("DAV timeout!"), "");
+#endif
+      return WAIT_FOR_DATA;
+    }
+  }
+  if (readWithEoi && eoiBit) *eoi = true;
+  return HANDSHAKE_COMPLETE;
+}
+
+
+/***** Queue a byte for the PIO source *****/
+/*
+ * Returns DATA_QUEUED: the byte has not been handshaked yet and the
+ * result comes from pioFlush(). Waits while both DMA buffers are busy and
+ * times out only if the source has made no progress for cfg.rtmo.
+ */
+enum gpibHandshakeState GPIBbus::pioWriteByte(uint8_t db, bool isLastByte) {
+  if (!pioSourceQueueWait(db, (cfg.eoi && isLastByte), cfg.rtmo)) {
+#ifdef DEBUG_GPIBbus_SEND
+    DB_PRINT(F("PIO queue timeout!"), "");
+#endif
+    return HANDSHAKE_START;
+  }
+  return DATA_QUEUED;
+}
+
+
+/***** Wait for the PIO source to send all queued bytes *****/
+/*
+ * Times out only if the source has made no progress for cfg.rtmo.
+ */
+enum gpibHandshakeState GPIBbus::pioFlush() {
+  if (!pioSourceFlush(cfg.rtmo)) {
+#ifdef DEBUG_GPIBbus_SEND
+    DB_PRINT(F("PIO handshake timeout!"), "");
+#endif
+    return HANDSHAKE_START;
+  }
+  return HANDSHAKE_COMPLETE;
+}
+#endif
+
+
+/***** Write a block of bytes to the GPIB bus *****/
+/*
+ * (- the GPIB bus must already be configured to talk )
+ * EOI is asserted with the last byte when withEoi is set, regardless
+ * of the EOI setting in cfg.eoi.
+ */
+enum gpibHandshakeState GPIBbus::writeBlock(const uint8_t *data, size_t dsize, bool withEoi) {
+  enum gpibHandshakeState state = HANDSHAKE_COMPLETE;
+
+  for (size_t i=0; i<dsize; i++) {
+    state = handshakeByte(data[i], (withEoi && (i == (dsize - 1))));
+    if (state != HANDSHAKE_COMPLETE) break;
+  }
+  return state;
+}
+
+
+/***** Source handshake for one byte, optionally with EOI *****/
+enum gpibHandshakeState GPIBbus::handshakeByte(uint8_t db, bool assertEoi) {
   unsigned long startMillis = millis();
   unsigned long currentMillis = startMillis + 1;
   const unsigned long timeval = cfg.rtmo;
@@ -1254,18 +1848,15 @@ enum gpibHandshakeState GPIBbus::writeByte(uint8_t db, bool isLastByte) {
     }
 
     if (gpibState == PLACE_DATA) {
-      // Place data on the bus
-      setGpibDbus(db);
-      if (cfg.eoi && isLastByte) {
-        // If EOI enabled and this is the last byte then assert DAV and EOI
+      // Place data on the bus, together with EOI if enabled and this is the last byte
 #ifdef DEBUG_GPIBbus_SEND
-        DB_PRINT(F("Asserting EOI..."), "");
+      if (assertEoi) DB_PRINT(F("Asserting EOI..."), "");
 #endif
-        assertSignal(DAV_BIT | EOI_BIT);
-      } else {
-        // Assert DAV (data is valid - ready to collect)
-        assertSignal(DAV_BIT);
-      }
+      setGpibDbusCtrl(db, 0, (assertEoi ? EOI_BIT : 0));
+      // Allow the data lines to settle
+      if (settle_s_time) delayMicroseconds(settle_s_time);
+      // Assert DAV (data is valid - ready to collect)
+      assertSignal(DAV_BIT);
       gpibState = DATA_READY;
     }
 
@@ -1288,15 +1879,8 @@ enum gpibHandshakeState GPIBbus::writeByte(uint8_t db, bool isLastByte) {
 
   // Handshake complete
   if (gpibState == HANDSHAKE_COMPLETE) {
-    if (cfg.eoi && isLastByte) {
-      // If EOI enabled and this is the last byte then un-assert both DAV and EOI
-      clearSignal(DAV_BIT | EOI_BIT);
-    } else {
-      // Unassert DAV
-      clearSignal(DAV_BIT);
-    }
-    // Reset the data bus
-    setGpibDbus(0);
+    // Unassert DAV (and EOI if it was asserted) and reset the data bus in one go
+    setGpibDbusCtrl(0, DAV_BIT | EOI_BIT, (assertEoi ? (DAV_BIT | EOI_BIT) : DAV_BIT));
     return gpibState;
   }
 
@@ -16,6 +16,10 @@
 
 #define GPIB_CFG_SIZE 83
 
+/***** Listener discovery *****/
+#define BUSMAP_SEC_SIZE 15    // Max number of secondary addresses held in the bus map
+#define PROBE_TIME_US 1600    // Time a listener must hold NDAC to be detected (us)
+
 
 /***** Universal Multiline commands (apply to all devices) *****/
 #define GC_GTL 0x01
@@ -90,7 +94,8 @@ enum gpibHandshakeState: uint8_t {
   WAIT_FOR_RECEIVER_READY,
   PLACE_DATA,
   DATA_READY,
-  RECEIVER_ACCEPTING
+  RECEIVER_ACCEPTING,
+  DATA_QUEUED       // PIO source: byte queued, result from pioFlush()
 };
 
 
@@ -162,6 +167,19 @@ public:
 
   union GPIBconf cfg;
 
+  /***** Listeners found on the bus (valid until IFC) *****/
+  struct GPIBmap {
+    uint32_t scanned;               // Bit n set: address n has been probed
+    uint32_t pri;                   // Bit n set: listener found at primary address n
+    uint32_t swept;                 // Bit n set: secondary addresses of n have been probed
+    uint32_t trunc;                 // Bit n set: not all secondaries of n fitted in the map
+    uint8_t scnt;                   // Number of secondary addresses recorded
+    uint8_t spri[BUSMAP_SEC_SIZE];  // Primary address of each secondary listener
+    uint8_t ssec[BUSMAP_SEC_SIZE];  // Secondary address (0x60-0x7E)
+  };
+
+  struct GPIBmap busMap;
+
   uint8_t cstate = 0;
 
   GPIBbus();
@@ -187,6 +205,7 @@ public:
   bool sendLLO();
   bool sendGTL();
   bool sendGET(uint8_t addr);
+  bool sendGroupGET(uint8_t pris[], uint8_t secs[], uint8_t cnt);
   bool sendSDC();
   bool sendTCT(uint8_t addr);
   void sendAllClear();
@@ -199,19 +218,29 @@ public:
 
   bool isAsserted(uint8_t gpibsig);
   void setControls(uint8_t state);
-  void sendStatus();
+  bool spollRespond(uint8_t statusByte);
 
   void setStatus(uint8_t statusByte);
   bool sendCmd(uint8_t cmdByte);
   bool sendSecondaryCmd(uint8_t paddr, uint8_t saddr, char * data, uint8_t dsize);
   enum gpibHandshakeState readByte(uint8_t *db, bool readWithEoi, bool *eoi);
+  enum gpibHandshakeState captureByte(uint8_t *db, uint8_t *flags, uint16_t idleUs);
+  size_t readBlock(uint8_t *buf, size_t bsize, uint16_t idleUs);
   enum gpibHandshakeState writeByte(uint8_t db, bool isLastByte);
+  enum gpibHandshakeState writeBlock(const uint8_t *data, size_t dsize, bool withEoi);
   enum receiveState receiveData(Stream &dataStream, bool detectEoi, bool detectEndByte, uint8_t endByte, size_t maxSize = 0);
   void sendData(const char *data, uint8_t dsize, bool isLastPacket = true);
+  enum receiveState waitTransfer(bool detectEoi, bool detectEndByte, uint8_t endByte);
   void clearDataBus();
   void setControlVal(uint8_t value);
   void setDataVal(uint8_t value);
 
+  void enableAtnInterrupt();
+  void disableAtnInterrupt();
+  void atnAcknowledge();
+  bool isAtnPending() { return atnPending; }
+  void clearAtnPending() { atnPending = false; }
+
   bool isDeviceAddressedToListen();
   bool isDeviceAddressedToTalk();
   bool isDeviceInIdleState();
@@ -219,6 +248,11 @@ public:
   void signalBreak();
 
   bool addressDevice(uint8_t pri, uint8_t sec, uint8_t dir);
+  bool addressListeners(uint8_t pris[], uint8_t secs[], uint8_t cnt);
+
+  bool mapListener(uint8_t pri, bool withSec);
+  void clearBusMap();
+  bool isListenerAbsent(uint8_t pri, uint8_t sec);
   bool unAddressDevice();
   adressingDirection haveAddressedDevice();
 
@@ -230,17 +264,27 @@ public:
 private:
 
   bool txBreak;  // Signal to break the GPIB transmission
+  bool blockDavHeld = false;         // readBlock(): byte accepted, DAV not yet released
+  volatile bool atnPending = false;  // ATN acknowledged by interrupt handler
+  bool atnIntEnabled = false;        // ATN interrupt handler attached
+  void applyControls(uint8_t state);
+  volatile bool ctrlSynced = false;  // Control lines still as set for cstate
+  enum gpibHandshakeState handshakeByte(uint8_t db, bool assertEoi);
   adressingDirection deviceAddressed;
   bool isTerminatorDetected(uint8_t bytes[3], uint8_t eorSequence);
+  bool probeNdac();
 
   // Adjustable settling times
   uint16_t settle_r_time; // receive settle time (in us)
   uint16_t settle_s_time; // send settle time (in us)
 
-  // Interrupt flag for MCP23S17
-#ifdef AR488_MCP23S17
-//    extern volatile bool mcpIntA;  // MCP23S17 interrupt handler
-//    uint8_t mcpPinAssertedReg = 0;
+#ifdef PICO_PIO_HANDSHAKE
+  // Data transfer handshake running in PIO
+  bool pioRx = false;
+  bool pioTx = false;
+  enum gpibHandshakeState pioReadByte(uint8_t *db, bool readWithEoi, bool *eoi);
+  enum gpibHandshakeState pioWriteByte(uint8_t db, bool isLastByte);
+  enum gpibHandshakeState pioFlush();
 #endif
 };
 
@@ -9,6 +9,11 @@
 ///       Hardware layout function definitions      ///
 ///=================================================///
 
+
+/***** Shared bit reversal table (generated, see AR488_Layouts.h) *****/
+const uint8_t revBitsTable[256] PROGMEM = { LUT_256(REV8, 0) };
+
+
 /*********************************/
 /***** UNO/NANO BOARD LAYOUT *****/
 /***** vvvvvvvvvvvvvvvvvvvvv *****/
@@ -394,25 +399,25 @@ void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
 /*
   Data pin map
   ------------
-  DIO1_PIN  37 : GPIB 1  : PA1
-  DIO2_PIN  35 : GPIB 2  : PA3
-  DIO3_PIN  33 : GPIB 3  : PA5
-  DIO4_PIN  31 : GPIB 4  : PA7
-  DIO5_PIN  29 : GPIB 13 : PC6
-  DIO6_PIN  27 : GPIB 14 : PC4
-  DIO7_PIN  25 : GPIB 15 : PC2
-  DIO8_PIN  23 : GPIB 16 : PC0
+  DIO1_PIN  37 : GPIB 1  : PC0
+  DIO2_PIN  35 : GPIB 2  : PC2
+  DIO3_PIN  33 : GPIB 3  : PC4
+  DIO4_PIN  31 : GPIB 4  : PC6
+  DIO5_PIN  29 : GPIB 13 : PA7
+  DIO6_PIN  27 : GPIB 14 : PA5
+  DIO7_PIN  25 : GPIB 15 : PA3
+  DIO8_PIN  23 : GPIB 16 : PA1
 
   Control pin map
   ---------------
-  IFC_PIN   49 : GPIB  9 : PG0 : b0
-  NDAC_PIN  47 : GPIB  8 : PG2 : b1
-  NRFD_PIN  45 : GPIB  7 : PL6 : b2
-  DAV_PIN   43 : GPIB  6 : PL4 : b3
-  EOI_PIN   41 : GPIB  5 : PL2 : b4
-  REN_PIN   51 : GPIB 17 : PB0 : b5
-  SRQ_PIN   39 : GPIB 10 : PL0 : b6
-  ATN_PIN   53 : GPIB 11 : PB2 : b7
+  IFC_PIN   49 : GPIB  9 : PL0 : b0
+  NDAC_PIN  47 : GPIB  8 : PL2 : b1
+  NRFD_PIN  45 : GPIB  7 : PL4 : b2
+  DAV_PIN   43 : GPIB  6 : PL6 : b3
+  EOI_PIN   41 : GPIB  5 : PG0 : b4
+  REN_PIN   39 : GPIB 17 : PG2 : b5
+  SRQ_PIN   51 : GPIB 10 : PB2 : b6
+  ATN_PIN   53 : GPIB 11 : PB0 : b7
 
   Bits control lines as follows: 7-ATN_PIN, 6-SRQ_PIN, 5-REN_PIN, 4-EOI_PIN, 3-DAV_PIN, 2-NRFD_PIN, 1-NDAC_PIN, 0-IFC_PIN
     bits (databits) : State - 0=LOW, 1=HIGH/INPUT_PULLUP; Direction - 0=input, 1=output;
@@ -427,8 +432,8 @@ void readyGpibDbus() {
   DDRA &= 0b01010101 ;
   DDRC &= 0b10101010 ;
 
-  PORTA |= 0b10101010; // PORTC bits 7,5,3,1 input_pullup
-  PORTC |= 0b01010101; // PORTA bits 6,4,2,0 input_pullup
+  PORTA |= 0b10101010; // PORTA bits 7,5,3,1 input_pullup
+  PORTC |= 0b01010101; // PORTC bits 6,4,2,0 input_pullup
 }
 
 
@@ -440,15 +445,17 @@ uint8_t readGpibDbus() {
   // Read the byte of data on the bus (GPIB states are inverted)
   val = ~((PINA & 0b10101010) + (PINC & 0b01010101));
 
-  db |= (((val >> 0) & 1)<<3);
-  db |= (((val >> 2) & 1)<<2);
-  db |= (((val >> 4) & 1)<<1);
-  db |= (((val >> 6) & 1)<<0);
+  // DIO1-4 on PC0,2,4,6 (pins 37,35,33,31)
+  db |= (((val >> 0) & 1)<<0);
+  db |= (((val >> 2) & 1)<<1);
+  db |= (((val >> 4) & 1)<<2);
+  db |= (((val >> 6) & 1)<<3);
 
-  db |= (((val >> 7) & 1)<<7);
-  db |= (((val >> 5) & 1)<<6);
-  db |= (((val >> 3) & 1)<<5);
-  db |= (((val >> 1) & 1)<<4);
+  // DIO5-8 on PA7,5,3,1 (pins 29,27,25,23)
+  db |= (((val >> 7) & 1)<<4);
+  db |= (((val >> 5) & 1)<<5);
+  db |= (((val >> 3) & 1)<<6);
+  db |= (((val >> 1) & 1)<<7);
 
   return db;
 }
@@ -465,15 +472,17 @@ void setGpibDbus(uint8_t db) {
   // GPIB states are inverted
   db = ~db;
 
-  val |= (((db >> 4) & 1)<<1);
-  val |= (((db >> 5) & 1)<<3);
-  val |= (((db >> 6) & 1)<<5);
-  val |= (((db >> 7) & 1)<<7);
+  // DIO1-4 on PC0,2,4,6 (pins 37,35,33,31)
+  val |= (((db >> 0) & 1)<<0);
+  val |= (((db >> 1) & 1)<<2);
+  val |= (((db >> 2) & 1)<<4);
+  val |= (((db >> 3) & 1)<<6);
 
-  val |= (((db >> 0) & 1)<<6);
-  val |= (((db >> 1) & 1)<<4);
-  val |= (((db >> 2) & 1)<<2);
-  val |= (((db >> 3) & 1)<<0);
+  // DIO5-8 on PA7,5,3,1 (pins 29,27,25,23)
+  val |= (((db >> 4) & 1)<<7);
+  val |= (((db >> 5) & 1)<<5);
+  val |= (((db >> 6) & 1)<<3);
+  val |= (((db >> 7) & 1)<<1);
 
   // Set data bus
   PORTA = (PORTA & ~0b10101010) | (val & 0b10101010);
@@ -736,18 +745,31 @@ void readyGpibDbus() {
 }
 
 
+/***** Port F <-> data bus tables *****/
+/*
+  Port F carries DIO1-DIO6 on bits 7-4 and 1-0 in reverse order. Both
+  directions, including the inversion of GPIB states, are looked up.
+*/
+#define LR3_PINF_DB(v)  (uint8_t)(~REV8( ((v) & 0b11110000) + (((v) & 0b00000011) << 2) ) & 0b00111111)
+#define LR3_DB_PORTF(v) (uint8_t)( REV8( (~(v) & 0b00001111) + ((~(v) & 0b00110000) << 2) ) & 0b11110011)
+
+const uint8_t lr3PinfToDb[256] PROGMEM = { LUT_256(LR3_PINF_DB, 0) };
+const uint8_t lr3DbToPortf[256] PROGMEM = { LUT_256(LR3_DB_PORTF, 0) };
+
+
 /***** Read the GPIB data bus wires to collect the byte of data *****/
 uint8_t readGpibDbus() {
   // Read the byte of data on the bus
-  uint8_t portf = reverseBits( (PINF & 0b11110000) + ((PINF & 0b00000011) << 2) );
-  return ~( ((PIND & 0b00010000) << 2) + ((PINC & 0b01000000) <<1) + portf );
+  uint8_t dbhi = ((PIND & 0b00010000) << 2) | ((PINC & 0b01000000) << 1);
+  return pgm_read_byte(&lr3PinfToDb[PINF]) | (~dbhi & 0b11000000);
 }
 
 
 /***** Set the GPIB data bus to output and with the requested byte *****/
 void setGpibDbus(uint8_t db) {
-//  uint8_t rdb;
-  uint8_t portf;
+  // Port F require bits mapped to 0-1 and 4-7 in reverse order
+  uint8_t portf = pgm_read_byte(&lr3DbToPortf[db]);
+
   // Set data pins as outputs
   DDRC |= 0b01000000;
   DDRD |= 0b00010000;
@@ -756,13 +778,10 @@ void setGpibDbus(uint8_t db) {
   // GPIB states are inverted
   db = ~db;
 
-  // Port F require bits mapped to 0-1 and 4-7 in reverse order
-  portf = reverseBits((db & 0b00001111) + ((db & 0b00110000) << 2));
-
   // Set data bus
   PORTC = (PORTC & ~0b01000000) | ((db & 0b10000000) >> 1);
   PORTD = (PORTD & ~0b00010000) | ((db & 0b01000000) >> 2);
-  PORTF = (PORTF & ~0b11110011) | (portf & 0b11110011);
+  PORTF = (PORTF & ~0b11110011) | portf;
 }
 
 
@@ -802,14 +821,6 @@ void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
   DDRE = ( (DDRE & ~portEm) | (portEb & portEm) );
 }
 
-
-uint8_t reverseBits(uint8_t dbyte) {
-   dbyte = (dbyte & 0xF0) >> 4 | (dbyte & 0x0F) << 4;
-   dbyte = (dbyte & 0xCC) >> 2 | (dbyte & 0x33) << 2;
-   dbyte = (dbyte & 0xAA) >> 1 | (dbyte & 0x55) << 1;
-   return dbyte;
-}
-
 #endif //AR488_MEGA32U4_LR3
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** LEONARDO R3 BOARD LAYOUT *****/
@@ -853,29 +864,103 @@ uint8_t reverseBits(uint8_t dbyte) {
 // MCP23S17 hardware config
 const uint8_t chipSelect = MCP_SELECTPIN;
 const uint8_t mcpAddr = MCP_ADDRESS;      // Must be between 0 and 7
-uint8_t mcpIntAReg = 0;
+SPISettings mcpSpiCfg(MCP_SPI_CLOCK, MSBFIRST, SPI_MODE0);
+
+// Shadow copies of the expander registers (MCP23S17: DIR 0 = output, 1 = input)
+uint8_t mcpDirA = 0xFF;
+uint8_t mcpDirB = 0xFF;
+uint8_t mcpPuA = 0x00;
+uint8_t mcpPuB = 0x00;
+uint8_t mcpOlatA = 0x00;
+uint8_t mcpOlatB = 0x00;
+
+// Port A as last read. Input pins raise an interrupt on change and INTA
+// stays asserted until GPIOA is read, so the input bits stay valid while
+// INTA is inactive. Output pins are served from the OLATA shadow.
+uint8_t mcpPortA = 0xFF;
+uint8_t mcpIntEnA = 0x00;
+volatile bool mcpIntA = false;
+
+// ATN, IFC and SRQ assertions captured in INTCAPA and not yet reported
+const uint8_t mcpLatchMask = (1<<ATN_PIN) | (1<<IFC_PIN) | (1<<SRQ_PIN);
+uint8_t mcpLatchA = 0x00;
+
+#ifdef __AVR__
+volatile uint8_t *mcpCsPort;
+volatile uint8_t *mcpIntPort;
+uint8_t mcpCsMask;
+uint8_t mcpIntMask;
+#endif
+
+
+/***** Select and de-select the MCP23S17 *****/
+inline void mcpSelect(bool state){
+#ifdef __AVR__
+  if (state) {
+    *mcpCsPort &= ~mcpCsMask;
+  }else{
+    *mcpCsPort |= mcpCsMask;
+  }
+#else
+  digitalWrite(chipSelect, (state ? LOW : HIGH));
+#endif
+}
+
+
+/***** Check whether INTA is asserted *****/
+inline bool mcpIntAsserted(){
+#ifdef __AVR__
+  return !(*mcpIntPort & mcpIntMask);
+#else
+  return (digitalRead(MCP_INTERRUPT) == LOW);
+#endif
+}
 
 
 /***** Ready the SPI bus *****/
 void mcpInit(){
+#ifdef __AVR__
+  mcpCsPort = portOutputRegister(digitalPinToPort(chipSelect));
+  mcpCsMask = digitalPinToBitMask(chipSelect);
+  mcpIntPort = portInputRegister(digitalPinToPort(MCP_INTERRUPT));
+  mcpIntMask = digitalPinToBitMask(MCP_INTERRUPT);
+#endif
   SPI.begin();
-  // Optional: Clock divider (slow down the bus speed [optional])
-  SPI.setClockDivider(SPI_CLOCK_DIV8);
   // Set expander configuration register
   // (Bit 1=0 sets active low for Int A)
   // (Bit 3=1 enables hardware address pins (MCP23S17 only)
+  // (Bit 5=0 address pointer increments so A/B register pairs can be written in one transfer)
   // (Bit 7=0 sets registers to be in same bank)
   mcpByteWrite(MCPCON, 0b00001000);
+  // Known state for the shadowed registers: all pins input with pullup, latches unasserted
+  mcpWordWrite(MCPDIRA, 0xFF, 0xFF);
+  mcpWordWrite(MCPPUA, 0xFF, 0xFF);
+  mcpWordWrite(MCPOLATA, 0xFF, 0xFF);
+  mcpDirA = 0xFF;
+  mcpDirB = 0xFF;
+  mcpPuA = 0xFF;
+  mcpPuB = 0xFF;
+  mcpOlatA = 0xFF;
+  mcpOlatB = 0xFF;
   // Enable MCP23S17 interrupts
   mcpInterruptsEn();
+  mcpIntA = true;
+}
+
+
+/***** Write a register only when its shadow copy differs *****/
+inline void mcpShadowWrite(uint8_t reg, uint8_t &shadow, uint8_t db){
+  if (db == shadow) return;
+  mcpByteWrite(reg, db);
+  shadow = db;
 }
 
 
 /***** Set the GPIB data bus to input pullup *****/
 void readyGpibDbus() {
   // Set data pins to input
-  mcpByteWrite(MCPDIRB, 0b11111111);  // Port direction: 0 = output; 1 = input;
-  mcpByteWrite(MCPPUB, 0b11111111);   // 1 = Pullup resistors enabled
+  mcpShadowWrite(MCPDIRB, mcpDirB, 0b11111111);  // Port direction: 0 = output; 1 = input;
+  mcpShadowWrite(MCPPUB, mcpPuB, 0b11111111);    // 1 = Pullup resistors enabled
 }
 
 
@@ -889,68 +974,87 @@ uint8_t readGpibDbus() {
 /***** Set the GPIB data bus to output and with the requested byte *****/
 void setGpibDbus(uint8_t db) {
   // Set data pins as outputs
-  mcpByteWrite(MCPDIRB, 0b00000000);  // Port direction: 0 = output; 1 = input;
-
-  // GPIB states are inverted
-  db = ~db;
-
-  // Set data bus
-  mcpByteWrite(MCPPORTB, db);
+  mcpShadowWrite(MCPDIRB, mcpDirB, 0b00000000);  // Port direction: 0 = output; 1 = input;
+  // Set data bus (GPIB states are inverted)
+  mcpShadowWrite(MCPOLATB, mcpOlatB, ~db);
 }
 
 
 void setGpibCtrlState(uint8_t bits, uint8_t mask) {
-
-  uint8_t portAb = bits;
-  uint8_t portAm = mask;
-
-  uint8_t regByte = 0;
-  uint8_t regMod = 0; 
+  // Set pin states using mask: register = (register & ~bitmask) | (value & bitmask)
+  mcpShadowWrite(MCPOLATA, mcpOlatA, (mcpOlatA & ~mask) | (bits & mask));
+}
 
 
-  // Set registers: register = (register & ~bitmask) | (value & bitmask)
-  // Mask: 0=unaffected; 1=to be changed
-
-  // Set pin states using mask
-  regByte = mcpByteRead(MCPPORTA);
-  regMod = (regByte & ~portAm) | (portAb & portAm);
-  mcpByteWrite(MCPPORTA, regMod);
+/***** Set the data bus (as setGpibDbus) and control line states together *****/
+/*
+ * When both latches change they are written in one SPI transaction
+ */
+void setGpibDbusCtrl(uint8_t db, uint8_t bits, uint8_t mask) {
+  uint8_t olata = (mcpOlatA & ~mask) | (bits & mask);
+  uint8_t olatb = ~db;
+  mcpShadowWrite(MCPDIRB, mcpDirB, 0b00000000);  // Data port direction: output
+  if ((olata != mcpOlatA) && (olatb != mcpOlatB)) {
+    mcpWordWrite(MCPOLATA, olata, olatb);
+    mcpOlatA = olata;
+    mcpOlatB = olatb;
+  } else {
+    mcpShadowWrite(MCPOLATA, mcpOlatA, olata);
+    mcpShadowWrite(MCPOLATB, mcpOlatB, olatb);
+  }
 }
 
 
 void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
-
-  uint8_t portAb = bits;
-  uint8_t portAm = mask;
-
-  uint8_t regByte = 0;
-  uint8_t regMod = 0; 
-
-
-  // Set registers: register = (register & ~bitmask) | (value & bitmask)
-  // Mask: 0=unaffected; 1=to be changed
-
-  // Set pin direction registers using mask
-  regByte = ~mcpByteRead(MCPDIRA);   // Note: on MCP23S17 0 = output, 1 = input
-  regMod = (regByte & ~portAm) | (portAb & portAm);
-  mcpByteWrite(MCPDIRA, ~regMod);    // Note: on MCP23S17 0 = output, 1 = input
-
+  uint8_t dir = (mcpDirA & ~mask) | (~bits & mask);
+  if (dir == mcpDirA) return;
+  // Set pin direction using mask. Note: on MCP23S17 0 = output, 1 = input
+  mcpShadowWrite(MCPDIRA, mcpDirA, dir);
+  // Interrupt on change for input pins only
+  mcpShadowWrite(MCPINTENA, mcpIntEnA, dir);
+  // Pins that became inputs have not been sampled yet
+  mcpIntA = true;
 }
 
 
 /***** MCP23S17 interrupt handler *****/
 /*
  * Interrput pin on Arduino configure with attachInterrupt
+ * The SPI bus may be in use by the main loop so only flag the change here
  */
 void mcpIntHandler() {
-//  mcpIntA = true;
-//  Serial.println(F("MCP Interrupt triggered"));
-  mcpIntAReg = mcpByteRead(MCPINTCAPA);
+  mcpIntA = true;
 }
 
 
+/***** Return the current port A state *****/
+/*
+ * Input pins are re-read only when INTA signals a change. A single transfer
+ * reads INTFA (pin that raised the interrupt), INTFB, INTCAPA (pin state
+ * latched when the interrupt fired), INTCAPB and GPIOA, which also clears
+ * the interrupt.
+ */
 uint8_t getMcpIntAReg(){
-  return mcpIntAReg;
+  if (mcpIntA || mcpIntAsserted()) {
+    uint8_t intf;
+    uint8_t intcap;
+    mcpIntA = false;
+    SPI.beginTransaction(mcpSpiCfg);
+    mcpSelect(true);
+    SPI.transfer(MCPREAD | (mcpAddr << 1));
+    SPI.transfer(MCPINTFA);
+    intf = SPI.transfer(0x00);              // INTFA
+    SPI.transfer(0x00);                     // INTFB (unused)
+    intcap = SPI.transfer(0x00);            // INTCAPA
+    SPI.transfer(0x00);                     // INTCAPB (unused)
+    mcpPortA = SPI.transfer(0x00);          // GPIOA
+    mcpSelect(false);
+    SPI.endTransaction();
+    // Keep an assertion that may already have ended, but only on the pin
+    // that raised the interrupt (INTCAPA holds all pins at that moment)
+    mcpLatchA |= intf & ~intcap & mcpLatchMask;
+  }
+  return (mcpPortA & mcpDirA) | (mcpOlatA & ~mcpDirA);
 }
 
 
@@ -960,34 +1064,42 @@ uint8_t getMcpIntAReg(){
  */
 uint8_t mcpByteRead(uint8_t reg){
   uint8_t db;
-//Serial.print(F("Rx addr: "));
-//Serial.print(mcpAddr);
-  digitalWrite(chipSelect, LOW);            // Enable MCP communication
+  SPI.beginTransaction(mcpSpiCfg);
+  mcpSelect(true);                          // Enable MCP communication
   SPI.transfer(MCPREAD | (mcpAddr << 1));   // Write opcode + chip address + write bit
   SPI.transfer(reg);                        // Write the register we want to read
   db = SPI.transfer(0x00);                  // Send any byte. Function returns low byte (port A value) which is ignored
-  digitalWrite(chipSelect, HIGH);           // Enable MCP communication
-//uint8_t dbinv = ~db;
-//Serial.print(F("\tRCV: "));
-//Serial.println(dbinv, HEX);
+  mcpSelect(false);                         // Stop MCP communication
+  SPI.endTransaction();
   return db;
 }
 
 
 /***** Write to the MCP23S17 *****/
 void mcpByteWrite(uint8_t reg, uint8_t db){
-//Serial.print(F("Tx addr: "));
-//Serial.print(mcpAddr);
-  digitalWrite(chipSelect, LOW);            // Enable MCP communication
+  SPI.beginTransaction(mcpSpiCfg);
+  mcpSelect(true);                          // Enable MCP communication
   SPI.transfer(MCPWRITE | (mcpAddr << 1));  // Write opcode (with write bit set) + chip address
   SPI.transfer(reg);                        // Write register we want to change
   SPI.transfer(db);                         // Write data byte
-  digitalWrite(chipSelect, HIGH);           // Stop MCP communication
-//Serial.print(F("\tWRT: "));
-//Serial.print(db, HEX);
-//uint8_t dbinv = ~db;
-//Serial.print(F("\tWRTinv: "));
-//Serial.println(dbinv, HEX);
+  mcpSelect(false);                         // Stop MCP communication
+  SPI.endTransaction();
+}
+
+
+/***** Write an A/B register pair to the MCP23S17 in one transfer *****/
+/*
+ * reg : port A register, e.g. MCPDIRA. The port B register follows it (IOCON.BANK=0)
+ */
+void mcpWordWrite(uint8_t reg, uint8_t dba, uint8_t dbb){
+  SPI.beginTransaction(mcpSpiCfg);
+  mcpSelect(true);                          // Enable MCP communication
+  SPI.transfer(MCPWRITE | (mcpAddr << 1));  // Write opcode (with write bit set) + chip address
+  SPI.transfer(reg);                        // Write the port A register
+  SPI.transfer(dba);                        // Port A data byte
+  SPI.transfer(dbb);                        // Port B data byte (address pointer incremented)
+  mcpSelect(false);                         // Stop MCP communication
+  SPI.endTransaction();
 }
 
 
@@ -1000,8 +1112,14 @@ uint8_t mcpDigitalRead(uint8_t pin) {
   // If the pin value is larger than 7 then do nothing and return
   // Zero or larger value is implied by the variable type
   if (pin > 7) return 0x0;
-  // Read the port A pin state, extract and return HIGH/LOW state for the requested pin
-  return mcpByteRead(MCPPORTA) & (1 << pin) ? HIGH : LOW;
+  uint8_t portA = getMcpIntAReg();
+  // A latched assertion is reported once
+  if (mcpLatchA & (1 << pin)) {
+    mcpLatchA &= ~(1 << pin);
+    return LOW;
+  }
+  // Extract and return HIGH/LOW state for the requested pin
+  return portA & (1 << pin) ? HIGH : LOW;
 }
 
 
@@ -1015,8 +1133,9 @@ uint8_t getGpibPinState(uint8_t pin){
 void mcpInterruptsEn(){
   // Set to interrupt mode for compare to previous
   mcpByteWrite(MCPINTCONA, 0b00000000);
-  // Enable interrupt to detect pin state change on pins 4, 6 and 7 (EOI_PIN, SRQ_PIN and ATN_PIN)
-  mcpByteWrite(MCPINTENA, 0b11010000);
+  // Enable interrupt on change on the port A pins configured as inputs (DAV, NRFD, NDAC, ATN, SRQ etc)
+  mcpIntEnA = mcpDirA;
+  mcpByteWrite(MCPINTENA, mcpIntEnA);
 }
 
 #endif //AR488_MCP23S17
@@ -1092,13 +1211,10 @@ void setGpibDbus(uint8_t db) {
 }
 
 
-/***** Reverse the order of the bits in a byte *****/
-uint8_t reverseBits(uint8_t dbyte) {
-   dbyte = (dbyte & 0xF0) >> 4 | (dbyte & 0x0F) << 4;
-   dbyte = (dbyte & 0xCC) >> 2 | (dbyte & 0x33) << 2;
-   dbyte = (dbyte & 0xAA) >> 1 | (dbyte & 0x55) << 1;
-   return dbyte;
-}
+/***** Control bits 0-4 reversed onto port C bits 2-6 *****/
+#define MCGRAW_CTRL_PORTC(v) (uint8_t)(REV8(v) >> 1)
+
+const uint8_t mcgrawCtrlToPortC[32] PROGMEM = { LUT_32(MCGRAW_CTRL_PORTC, 0) };
 
 
 void setGpibCtrlState(uint8_t bits, uint8_t mask) {
@@ -1109,8 +1225,8 @@ void setGpibCtrlState(uint8_t bits, uint8_t mask) {
 
   // PORT C- use the 5 right-most bits (bits 0 - 4) and bit 6
   // Reverse bits 0-4 and map to bits 2-6. Map bit 6 to bit 7
-  uint8_t portCb = (reverseBits(bits & 0x1F) >> 1) + ((bits & 0x40) << 1);
-  uint8_t portCm = (reverseBits(mask & 0x1F) >> 1) + ((mask & 0x40) << 1);
+  uint8_t portCb = pgm_read_byte(&mcgrawCtrlToPortC[bits & 0x1F]) + ((bits & 0x40) << 1);
+  uint8_t portCm = pgm_read_byte(&mcgrawCtrlToPortC[mask & 0x1F]) + ((mask & 0x40) << 1);
 
   // Set registers: register = (register & ~bitmask) | (value & bitmask)
   // Mask: 0=unaffected; 1=to be changed
@@ -1130,8 +1246,8 @@ void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
 
   // PORT C- use the 5 right-most bits (bits 0 - 4) and bit 6
   // Reverse bits 0-4 and map to bits 2-6. Map bit 6 to bit 7
-  uint8_t portCb = (reverseBits(bits & 0x1F) >> 1) + ((bits & 0x40) << 1);
-  uint8_t portCm = (reverseBits(mask & 0x1F) >> 1) + ((mask & 0x40) << 1);
+  uint8_t portCb = pgm_read_byte(&mcgrawCtrlToPortC[bits & 0x1F]) + ((bits & 0x40) << 1);
+  uint8_t portCm = pgm_read_byte(&mcgrawCtrlToPortC[mask & 0x1F]) + ((mask & 0x40) << 1);
 
   // Set registers: register = (register & ~bitmask) | (value & bitmask)
   // Mask: 0=unaffected; 1=to be changed
@@ -1296,7 +1412,7 @@ void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
 */
 
 
-uint8_t readPortPullupReg(PORT_t port){
+uint8_t readPortPullupReg(PORT_t &port){
   uint8_t reg = 0;
   reg |= (port.PIN0CTRL & PORT_PULLUPEN_bm) >> 3;
   reg |= (port.PIN1CTRL & PORT_PULLUPEN_bm) >> 2;
@@ -1310,16 +1426,16 @@ uint8_t readPortPullupReg(PORT_t port){
 }
 
 
-void setPortPullupBits(PORT_t port, uint8_t reg){
-  port.PIN0CTRL |= ((reg<<3) & PORT_PULLUPEN_bm);
-  port.PIN1CTRL |= ((reg<<2) & PORT_PULLUPEN_bm);
-  port.PIN2CTRL |= ((reg<<1) & PORT_PULLUPEN_bm);
-  port.PIN3CTRL |= (reg & PORT_PULLUPEN_bm);
-  port.PIN4CTRL |= ((reg>>1) & PORT_PULLUPEN_bm);
-  port.PIN5CTRL |= ((reg>>2) & PORT_PULLUPEN_bm);
-  port.PIN6CTRL |= ((reg>>3) & PORT_PULLUPEN_bm);
-  port.PIN7CTRL |= ((reg>>4) & PORT_PULLUPEN_bm);
-  
+void setPortPullupBits(PORT_t &port, uint8_t reg){
+  // Pull-up of each pin on (1) or off (0)
+  port.PIN0CTRL = (port.PIN0CTRL & ~PORT_PULLUPEN_bm) | ((reg<<3) & PORT_PULLUPEN_bm);
+  port.PIN1CTRL = (port.PIN1CTRL & ~PORT_PULLUPEN_bm) | ((reg<<2) & PORT_PULLUPEN_bm);
+  port.PIN2CTRL = (port.PIN2CTRL & ~PORT_PULLUPEN_bm) | ((reg<<1) & PORT_PULLUPEN_bm);
+  port.PIN3CTRL = (port.PIN3CTRL & ~PORT_PULLUPEN_bm) | (reg & PORT_PULLUPEN_bm);
+  port.PIN4CTRL = (port.PIN4CTRL & ~PORT_PULLUPEN_bm) | ((reg>>1) & PORT_PULLUPEN_bm);
+  port.PIN5CTRL = (port.PIN5CTRL & ~PORT_PULLUPEN_bm) | ((reg>>2) & PORT_PULLUPEN_bm);
+  port.PIN6CTRL = (port.PIN6CTRL & ~PORT_PULLUPEN_bm) | ((reg>>3) & PORT_PULLUPEN_bm);
+  port.PIN7CTRL = (port.PIN7CTRL & ~PORT_PULLUPEN_bm) | ((reg>>4) & PORT_PULLUPEN_bm);
 }
 
 
@@ -1353,18 +1469,15 @@ void setGpibDbus(uint8_t db) {
 }
 
 
-/***** Reverse the order of the bits in a byte *****/
-uint8_t reverseBits(uint8_t dbyte) {
-   dbyte = (dbyte & 0xF0) >> 4 | (dbyte & 0x0F) << 4;
-   dbyte = (dbyte & 0xCC) >> 2 | (dbyte & 0x33) << 2;
-   dbyte = (dbyte & 0xAA) >> 1 | (dbyte & 0x55) << 1;
-   return dbyte;
-}
+/***** Control bits 0-4 reversed onto port C bits 0-4 *****/
+#define POE_CTRL_PORTC(v) (uint8_t)(REV8(v) >> 3)
+
+const uint8_t poeCtrlToPortC[32] PROGMEM = { LUT_32(POE_CTRL_PORTC, 0) };
 
 
 uint8_t bitsToPort(uint8_t bits){
   // PORT C - keep bits 0-4, rotate bit 5 right 3 positions, bit 6 & 7 left 1 position on register
-  return (reverseBits(bits & 0x1F) >> 3) | ((bits & 0x20) << 2) | ((bits & 0x40) >> 1) | ((bits & 0x80) >> 1);
+  return pgm_read_byte(&poeCtrlToPortC[bits & 0x1F]) | ((bits & 0x20) << 2) | ((bits & 0x40) >> 1) | ((bits & 0x80) >> 1);
 }
 
 
@@ -1403,44 +1516,96 @@ void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
 /***** ESP32 LAYOUT DEFINITION *****/
 /***** vvvvvvvvvvvvvvvvvvvvvvv *****/
 #ifdef ESP32_DEVKIT1_WROOM_32
+/*
+  Data and control buses are driven through the GPIO_OUT and GPIO_ENABLE
+  W1TS/W1TC registers using masks generated from the pin defines. The bus
+  is read with one GPIO_IN read per register bank in use (GPIO_IN1 holds
+  GPIO32 and above). pinMode() at startup selects the GPIO function, routes
+  the GPIO output signal and enables the pull-ups, which are left enabled.
+*/
 
-////////// INCOMPLETE AND UNTESTED //////////
+typedef GpioBank8<DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN, uint64_t> gpioDbBank;
+typedef GpioBank8<IFC_PIN, NDAC_PIN, NRFD_PIN, DAV_PIN, EOI_PIN, REN_PIN, SRQ_PIN, ATN_PIN, uint64_t> gpioCtrlBank;
 
-const uint32_t gpioDbMask = 0x00003FC0;
-const uint32_t gpioCtrlMask = 0x003FC000;
-const uint8_t gpioDbOffset = 6;
-const uint8_t gpioCtrlOffset = 14;
+static_assert(gpioDbBank::isExact() && gpioCtrlBank::isExact(), "GPIB pins must be distinct GPIO pins");
+static_assert((gpioDbBank::mask & gpioCtrlBank::mask) == 0, "Data and control pins overlap");
 
+const uint32_t gpioDbMask1 = (uint32_t)(gpioDbBank::mask >> 32);
 
 const uint8_t databus[8] = { DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN };
 const uint8_t ctrlbus[8] = { IFC_PIN, NDAC_PIN, NRFD_PIN, DAV_PIN, EOI_PIN, REN_PIN, SRQ_PIN, ATN_PIN };
 
 
-/***** Set the GPIB data bus to input pullup *****/
-void readyGpibDbus() {
-//  unsigned long pinmask = setRegisterMask(databus);
-//  gpio_set_pull_mode(pinmask, INPUT_PULLUP);
-//  gpio_set_pullup_enable(pinmask, true);
+/***** Write bits to a register pair covering GPIO0-31 and GPIO32+ *****/
+inline void gpioWriteBanks(uint32_t reg0, uint32_t reg1, uint64_t bits) {
+  if ((uint32_t)bits) REG_WRITE(reg0, (uint32_t)bits);
+  if ((uint32_t)(bits >> 32)) REG_WRITE(reg1, (uint32_t)(bits >> 32));
 }
 
-/*
-  // Set pin state
+
+/***** Initialise all GPIB pins as input pullup *****/
+void initGpibPins() {
   for (uint8_t i=0; i<8; i++) {
-    if (mask&(1<<i)) digitalWrite( ctrlbus[i], ((bits&(1<<i)) ? HIGH : LOW) );
+    pinMode(databus[i], INPUT_PULLUP);
+    pinMode(ctrlbus[i], INPUT_PULLUP);
   }
+}
+
 
+/***** Set the GPIB data bus to input pullup *****/
+void readyGpibDbus() {
+  gpioWriteBanks(GPIO_ENABLE_W1TC_REG, GPIO_ENABLE1_W1TC_REG, gpioDbBank::mask);
 }
-*/
 
-unsigned long setRegisterMask(const uint8_t bus[]){
-  unsigned long pinreg = 0;
-  for (uint8_t i=0; i<8; i++){
-    pinreg = pinreg | (1<<databus[i]);
-  }
-  return pinreg;
+
+/***** Read the GPIB data bus wires to collect the byte of data *****/
+uint8_t readGpibDbus() {
+  uint64_t gpioall = REG_READ(GPIO_IN_REG);
+  if (gpioDbMask1) gpioall |= (uint64_t)REG_READ(GPIO_IN1_REG) << 32;
+  return (uint8_t)~gpioDbBank::gather(gpioall);
+}
+
+
+/***** Set the GPIB data bus to output and with the requested byte *****/
+void setGpibDbus(uint8_t db) {
+  uint64_t gpiohigh = gpioDbBank::scatter((uint8_t)~db);
+  gpioWriteBanks(GPIO_OUT_W1TS_REG, GPIO_OUT1_W1TS_REG, gpiohigh);
+  gpioWriteBanks(GPIO_OUT_W1TC_REG, GPIO_OUT1_W1TC_REG, gpioDbBank::mask & ~gpiohigh);
+  gpioWriteBanks(GPIO_ENABLE_W1TS_REG, GPIO_ENABLE1_W1TS_REG, gpioDbBank::mask);
+}
+
+
+/***** Set the data bus (as setGpibDbus) and control line states together *****/
+void setGpibDbusCtrl(uint8_t db, uint8_t bits, uint8_t mask) {
+  uint64_t gpiomask = gpioDbBank::mask | gpioCtrlBank::scatter(mask);
+  uint64_t gpiohigh = gpioDbBank::scatter((uint8_t)~db) | gpioCtrlBank::scatter(bits & mask);
+  gpioWriteBanks(GPIO_OUT_W1TS_REG, GPIO_OUT1_W1TS_REG, gpiohigh);
+  gpioWriteBanks(GPIO_OUT_W1TC_REG, GPIO_OUT1_W1TC_REG, gpiomask & ~gpiohigh);
+  gpioWriteBanks(GPIO_ENABLE_W1TS_REG, GPIO_ENABLE1_W1TS_REG, gpioDbBank::mask);
+}
+
+
+/*
+   Bits control lines as follows: 7-ATN_PIN, 6-SRQ_PIN, 5-REN_PIN, 4-EOI_PIN, 3-DAV_PIN, 2-NRFD_PIN, 1-NDAC_PIN, 0-IFC_PIN
+    - bits : 0=LOW, 1=HIGH
+    - mask : 0=unaffected, 1=affected
+    Has relevance only to output pins
+*/
+void setGpibCtrlState(uint8_t bits, uint8_t mask) {
+  gpioWriteBanks(GPIO_OUT_W1TS_REG, GPIO_OUT1_W1TS_REG, gpioCtrlBank::scatter(bits & mask));
+  gpioWriteBanks(GPIO_OUT_W1TC_REG, GPIO_OUT1_W1TC_REG, gpioCtrlBank::scatter((uint8_t)~bits & mask));
 }
 
-////////// INCOMPLETE AND UNTESTED //////////
+
+/*
+   Bits control lines as follows: 7-ATN_PIN, 6-SRQ_PIN, 5-REN_PIN, 4-EOI_PIN, 3-DAV_PIN, 2-NRFD_PIN, 1-NDAC_PIN, 0-IFC_PIN
+    bits : 0=input pullup, 1=output
+    mask : 0=unaffected, 1=affected
+*/
+void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
+  gpioWriteBanks(GPIO_ENABLE_W1TS_REG, GPIO_ENABLE1_W1TS_REG, gpioCtrlBank::scatter(bits & mask));
+  gpioWriteBanks(GPIO_ENABLE_W1TC_REG, GPIO_ENABLE1_W1TC_REG, gpioCtrlBank::scatter((uint8_t)~bits & mask));
+}
 
 #endif // ESP32_DEVKIT1_WROOM_32
 /***** ^^^^^^^^^^^^^^^^^^^^^^^ *****/
@@ -1487,6 +1652,15 @@ const uint32_t gpioCtrlMask = 0x003FC000;
 const uint8_t gpioDbOffset = 6;
 const uint8_t gpioCtrlOffset = 14;
 
+/***** Generated bank maps, checked against the hand values above *****/
+typedef GpioBank8<DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN> gpioDbBank;
+typedef GpioBank8<IFC_PIN, NDAC_PIN, NRFD_PIN, DAV_PIN, EOI_PIN, REN_PIN, SRQ_PIN, ATN_PIN> gpioCtrlBank;
+
+static_assert(gpioDbBank::mask == gpioDbMask, "Data pin map does not match gpioDbMask");
+static_assert(gpioCtrlBank::mask == gpioCtrlMask, "Control pin map does not match gpioCtrlMask");
+static_assert(gpioDbBank::isExact() && gpioDbBank::isShift(gpioDbOffset), "Data pin map differs from gpioDbOffset shift");
+static_assert(gpioCtrlBank::isExact() && gpioCtrlBank::isShift(gpioCtrlOffset), "Control pin map differs from gpioCtrlOffset shift");
+
 
 void gpioFuncList(){
   /*
@@ -1548,21 +1722,28 @@ void readyGpibDbus() {
 /***** Read the GPIB data bus wires to collect the byte of data *****/
 uint8_t readGpibDbus() {
   // Read the byte of data on the bus
-  uint32_t gpioall = gpio_get_all();
-  gpioall = (gpioall & gpioDbMask) >> gpioDbOffset;
-  return (uint8_t)~gpioall;  
+  return (uint8_t)~gpioDbBank::gather(gpio_get_all());
 }
 
 
 /***** Set the GPIB data bus to output and with the requested byte *****/
 void setGpibDbus(uint8_t db) {
-  uint32_t gpioall = ((uint8_t)~db) << gpioDbOffset;
+  uint32_t gpioall = gpioDbBank::scatter((uint8_t)~db);
   gpio_clear_pullups_masked(gpioDbMask);
   gpio_set_dir_out_masked(gpioDbMask);
   gpio_put_masked(gpioDbMask, gpioall);
 }
 
 
+/***** Set the data bus (as setGpibDbus) and control line states in one write *****/
+void setGpibDbusCtrl(uint8_t db, uint8_t bits, uint8_t mask) {
+  uint32_t gpioall = gpioDbBank::scatter((uint8_t)~db) | gpioCtrlBank::scatter(bits & mask);
+  gpio_clear_pullups_masked(gpioDbMask);
+  gpio_set_dir_out_masked(gpioDbMask);
+  gpio_put_masked(gpioDbMask | gpioCtrlBank::scatter(mask), gpioall);
+}
+
+
 /*
    Bits control lines as follows: 7-ATN_PIN, 6-SRQ_PIN, 5-REN_PIN, 4-EOI_PIN, 3-DAV_PIN, 2-NRFD_PIN, 1-NDAC_PIN, 0-IFC_PIN
     - bits : 0=LOW, 1=HIGH
@@ -1571,8 +1752,8 @@ void setGpibDbus(uint8_t db) {
 */
 void setGpibCtrlState(uint8_t bits, uint8_t mask){
 
-  uint32_t gpiobits = (uint8_t)(bits & mask) << gpioCtrlOffset;
-  uint32_t gpioOmask = (mask << gpioCtrlOffset);
+  uint32_t gpiobits = gpioCtrlBank::scatter(bits & mask);
+  uint32_t gpioOmask = gpioCtrlBank::scatter(mask);
 
   gpio_put_masked(gpioOmask, gpiobits);
 
@@ -1586,8 +1767,8 @@ void setGpibCtrlState(uint8_t bits, uint8_t mask){
 */
 void setGpibCtrlDir(uint8_t bits, uint8_t mask){
 
-  uint32_t gpioOmask = ( (bits & mask) << gpioCtrlOffset );
-  uint32_t gpioImask = ( ((uint8_t)~bits & mask) << gpioCtrlOffset );
+  uint32_t gpioOmask = gpioCtrlBank::scatter(bits & mask);
+  uint32_t gpioImask = gpioCtrlBank::scatter((uint8_t)~bits & mask);
 
   if (gpioOmask){
     gpio_clear_pullups_masked(gpioOmask);
@@ -1648,6 +1829,15 @@ const uint32_t gpioCtrlMask = 0x00003FC0;
 const uint8_t gpioDbOffset = 14;
 const uint8_t gpioCtrlOffset = 6;
 
+/***** Generated bank maps, checked against the hand values above *****/
+typedef GpioBank8<DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN> gpioDbBank;
+typedef GpioBank8<IFC_PIN, NDAC_PIN, NRFD_PIN, DAV_PIN, EOI_PIN, REN_PIN, SRQ_PIN, ATN_PIN> gpioCtrlBank;
+
+static_assert(gpioDbBank::mask == gpioDbMask, "Data pin map does not match gpioDbMask");
+static_assert(gpioCtrlBank::mask == gpioCtrlMask, "Control pin map does not match gpioCtrlMask");
+static_assert(gpioDbBank::isExact() && gpioDbBank::isShift(gpioDbOffset), "Data pin map differs from gpioDbOffset shift");
+static_assert(gpioCtrlBank::isExact() && gpioCtrlBank::isShift(gpioCtrlOffset), "Control pin map differs from gpioCtrlOffset shift");
+
 
 void gpioFuncList(){
   /*
@@ -1685,15 +1875,6 @@ void gpio_clear_pullups_masked(uint32_t mask){
   }
 }
 
-/*
-uint8_t reverseBits(uint8_t dbyte) {
-   dbyte = (dbyte & 0xF0) >> 4 | (dbyte & 0x0F) << 4;
-   dbyte = (dbyte & 0xCC) >> 2 | (dbyte & 0x33) << 2;
-   dbyte = (dbyte & 0xAA) >> 1 | (dbyte & 0x55) << 1;
-   return dbyte;
-}
-*/
-
 /***** Initialise all GPIO pins *****/
 void initRpGpioPins(){
   uint32_t gpiomask = gpioCtrlMask | gpioDbMask;  // Scope of GPIO pins to be allocated to GPIB
@@ -1730,9 +1911,7 @@ uint8_t readGpibDbus() {
 /***** Read the GPIB data bus wires to collect the byte of data *****/
 uint8_t readGpibDbus() {
   // Read the byte of data on the bus
-  uint32_t gpioall = gpio_get_all();
-  gpioall = (gpioall & gpioDbMask) >> gpioDbOffset;
-  return (uint8_t)~gpioall;  
+  return (uint8_t)~gpioDbBank::gather(gpio_get_all());
 }
 
 
@@ -1751,13 +1930,22 @@ void setGpibDbus(uint8_t db) {
 
 /***** Set the GPIB data bus to output and with the requested byte *****/
 void setGpibDbus(uint8_t db) {
-  uint32_t gpioall = ((uint8_t)~db) << gpioDbOffset;
+  uint32_t gpioall = gpioDbBank::scatter((uint8_t)~db);
   gpio_clear_pullups_masked(gpioDbMask);
   gpio_set_dir_out_masked(gpioDbMask);
   gpio_put_masked(gpioDbMask, gpioall);
 }
 
 
+/***** Set the data bus (as setGpibDbus) and control line states in one write *****/
+void setGpibDbusCtrl(uint8_t db, uint8_t bits, uint8_t mask) {
+  uint32_t gpioall = gpioDbBank::scatter((uint8_t)~db) | gpioCtrlBank::scatter(bits & mask);
+  gpio_clear_pullups_masked(gpioDbMask);
+  gpio_set_dir_out_masked(gpioDbMask);
+  gpio_put_masked(gpioDbMask | gpioCtrlBank::scatter(mask), gpioall);
+}
+
+
 /***** Set the direction and state of the GPIB control lines ****/
 /*
    Bits control lines as follows: 7-ATN_PIN, 6-SRQ_PIN, 5-REN_PIN, 4-EOI_PIN, 3-DAV_PIN, 2-NRFD_PIN, 1-NDAC_PIN, 0-IFC_PIN
@@ -1784,8 +1972,8 @@ void setGpibDbus(uint8_t db) {
 */
 void setGpibCtrlState(uint8_t bits, uint8_t mask){
 
-  uint32_t gpiobits = (uint8_t)(bits & mask) << gpioCtrlOffset;
-  uint32_t gpioOmask = (mask << gpioCtrlOffset);
+  uint32_t gpiobits = gpioCtrlBank::scatter(bits & mask);
+  uint32_t gpioOmask = gpioCtrlBank::scatter(mask);
 
   gpio_put_masked(gpioOmask, gpiobits);
 
@@ -1799,8 +1987,8 @@ void setGpibCtrlState(uint8_t bits, uint8_t mask){
 */
 void setGpibCtrlDir(uint8_t bits, uint8_t mask){
 
-  uint32_t gpioOmask = ( (bits & mask) << gpioCtrlOffset );
-  uint32_t gpioImask = ( ((uint8_t)~bits & mask) << gpioCtrlOffset );
+  uint32_t gpioOmask = gpioCtrlBank::scatter(bits & mask);
+  uint32_t gpioImask = gpioCtrlBank::scatter((uint8_t)~bits & mask);
 
   if (gpioOmask){
     gpio_clear_pullups_masked(gpioOmask);
@@ -1825,42 +2013,49 @@ void setGpibCtrlDir(uint8_t bits, uint8_t mask){
 /***** NANO RP2040 CONNECT BOARD LAYOUT *****/
 /***** vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv *****/
 #ifdef RPI_NANO_RP2040
+/*
+  Data pin map
+  ------------
+  DIO1_PIN  21 : GPIB 1  : GPIO21
+  DIO2_PIN  20 : GPIB 2  : GPIO20
+  DIO3_PIN  19 : GPIB 3  : GPIO19
+  DIO4_PIN  18 : GPIB 4  : GPIO18
+  DIO5_PIN  17 : GPIB 13 : GPIO17
+  DIO6_PIN  16 : GPIB 14 : GPIO16
+  DIO7_PIN  15 : GPIB 15 : GPIO15
+  DIO8_PIN  25 : GPIB 16 : GPIO25
+*/
 
 const uint32_t gpioDbMask = 0x23F8000;
 const uint32_t gpioCtrlMask = 0x300030D0;
 
-uint32_t reverseBits(uint32_t dbyte) {
-   dbyte = (dbyte & 0xF0) >> 4 | (dbyte & 0x0F) << 4;
-   dbyte = (dbyte & 0xCC) >> 2 | (dbyte & 0x33) << 2;
-   dbyte = (dbyte & 0xAA) >> 1 | (dbyte & 0x55) << 1;
-   return dbyte;
-}
+/***** Generated bank map, checked against the hand value above *****/
+typedef GpioBank8<DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN> gpioDbBank;
+
+static_assert(gpioDbBank::mask == gpioDbMask, "Data pin map does not match gpioDbMask");
+static_assert(gpioDbBank::isExact(), "Data pin map does not round trip");
 
 
 void readyGpibDbus() {
   // Set data pins to input  
-  gpio_init_mask(0x023F8000);
-  gpio_set_dir_in_masked(0x023F8000);
-  gpio_set_pullups_masked(0x023F8000);
+  gpio_init_mask(gpioDbMask);
+  gpio_set_dir_in_masked(gpioDbMask);
+  gpio_set_pullups_masked(gpioDbMask);
 }
 
 
 /***** Read the GPIB data bus wires to collect the byte of data *****/
 uint8_t readGpibDbus() {
   // Read the byte of data on the bus
-  uint32_t gpioall = gpio_get_all();
-  uint32_t result1 = reverseBits(gpioall << 6);
-  uint32_t result2 = gpioall >> 25;
-  gpioall = result1 + result2;  
-  return (uint8_t)~gpioall;
+  return (uint8_t)~gpioDbBank::gather(gpio_get_all());
 }
 
 
 /***** Set the GPIB data bus to output and with the requested byte *****/
 void setGpibDbus(uint8_t db) {
-  uint32_t gpioall = db << 6;
-  gpio_set_dir_out_masked(0x023F8000);
-  gpio_put_masked(0x023F8000, gpioall);
+  uint32_t gpioall = gpioDbBank::scatter((uint8_t)~db);
+  gpio_set_dir_out_masked(gpioDbMask);
+  gpio_put_masked(gpioDbMask, gpioall);
 }
 
 #endif // RPI_NANO_RP2040
@@ -1874,7 +2069,7 @@ void setGpibDbus(uint8_t db) {
 /***** CUSTOM PIN LAYOUT SECTION *****/
 /***** vvvvvvvvvvvvvvvvvvvvvvvvv *****/
 //#ifdef AR488_CUSTOM
-#if defined (AR488_CUSTOM) || defined (NON_ARDUINO)
+#if defined (AR488_CUSTOM) || ( defined (NON_ARDUINO) && !defined(ESP32_DEVKIT1_WROOM_32) )
 
 
 uint8_t databus[8] = { DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN };
@@ -1882,6 +2077,331 @@ uint8_t databus[8] = { DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PI
 uint8_t ctrlbus[8] = { IFC_PIN, NDAC_PIN, NRFD_PIN, DAV_PIN, EOI_PIN, REN_PIN, SRQ_PIN, ATN_PIN };
 
 
+#if defined(__AVR__) && !defined(__AVR_XMEGA__)
+
+/*
+  Classic AVR: the pins of each bus are grouped by port at startup so that
+  every operation reads or writes each port register once. Bus bit n is
+  carried by bit avrBmask[n] of port group avrBgrp[n].
+*/
+
+struct avrPortGroup {
+  volatile uint8_t *pin;
+  volatile uint8_t *ddr;
+  volatile uint8_t *port;
+  uint8_t mask;
+};
+
+struct avrBusMap {
+  uint8_t ngrp;
+  avrPortGroup grp[8];
+  uint8_t bgrp[8];
+  uint8_t bmask[8];
+};
+
+avrBusMap dbMap;
+avrBusMap ctrlMap;
+
+
+/***** Group the pins of a bus by port *****/
+void avrMapBus(avrBusMap &map, const uint8_t bus[]) {
+  map.ngrp = 0;
+  for (uint8_t i=0; i<8; i++) {
+    uint8_t port = digitalPinToPort(bus[i]);
+    volatile uint8_t *preg = portOutputRegister(port);
+    uint8_t g = 0;
+    while ( (g < map.ngrp) && (map.grp[g].port != preg) ) g++;
+    if (g == map.ngrp) {
+      map.grp[g].pin = portInputRegister(port);
+      map.grp[g].ddr = portModeRegister(port);
+      map.grp[g].port = preg;
+      map.grp[g].mask = 0;
+      map.ngrp++;
+    }
+    map.bgrp[i] = g;
+    map.bmask[i] = digitalPinToBitMask(bus[i]);
+    map.grp[g].mask |= map.bmask[i];
+  }
+}
+
+
+/***** Initialise the port maps and set all GPIB pins to input pullup *****/
+void initGpibPins() {
+  avrMapBus(dbMap, databus);
+  avrMapBus(ctrlMap, ctrlbus);
+  for (uint8_t i=0; i<8; i++) {
+    pinMode(databus[i], INPUT_PULLUP);
+    pinMode(ctrlbus[i], INPUT_PULLUP);
+  }
+}
+
+
+/***** Set the GPIB data bus to input pullup *****/
+void readyGpibDbus() {
+  for (uint8_t g=0; g<dbMap.ngrp; g++) {
+    *dbMap.grp[g].ddr &= ~dbMap.grp[g].mask;
+    *dbMap.grp[g].port |= dbMap.grp[g].mask;
+  }
+}
+
+
+/***** Read the GPIB data bus wires to collect the byte of data *****/
+uint8_t readGpibDbus() {
+  uint8_t pval[8];
+  uint8_t db = 0;
+  for (uint8_t g=0; g<dbMap.ngrp; g++) {
+    pval[g] = *dbMap.grp[g].pin;
+  }
+  for (uint8_t i=0; i<8; i++) {
+    if ( !(pval[dbMap.bgrp[i]] & dbMap.bmask[i]) ) db |= (1<<i);
+  }
+  return db;
+}
+
+
+/***** Set the GPIB data bus to output and with the requested byte *****/
+void setGpibDbus(uint8_t db) {
+  uint8_t pval[8] = { 0 };
+  for (uint8_t i=0; i<8; i++) {
+    if ( !(db & (1<<i)) ) pval[dbMap.bgrp[i]] |= dbMap.bmask[i];
+  }
+  for (uint8_t g=0; g<dbMap.ngrp; g++) {
+    *dbMap.grp[g].ddr |= dbMap.grp[g].mask;
+    *dbMap.grp[g].port = (*dbMap.grp[g].port & ~dbMap.grp[g].mask) | pval[g];
+  }
+}
+
+
+/***** Set the state of the GPIB control lines *****/
+/*
+   Bits control lines as follows: 7-ATN_PIN, 6-SRQ_PIN, 5-REN_PIN, 4-EOI_PIN, 3-DAV_PIN, 2-NRFD_PIN, 1-NDAC_PIN, 0-IFC_PIN
+    bits : 0=LOW, 1=HIGH
+    mask : 0=unaffected, 1=affected
+*/
+void setGpibCtrlState(uint8_t bits, uint8_t mask) {
+  uint8_t pmask[8] = { 0 };
+  uint8_t pval[8] = { 0 };
+  for (uint8_t i=0; i<8; i++) {
+    if (mask & (1<<i)) {
+      pmask[ctrlMap.bgrp[i]] |= ctrlMap.bmask[i];
+      if (bits & (1<<i)) pval[ctrlMap.bgrp[i]] |= ctrlMap.bmask[i];
+    }
+  }
+  for (uint8_t g=0; g<ctrlMap.ngrp; g++) {
+    if (pmask[g]) *ctrlMap.grp[g].port = (*ctrlMap.grp[g].port & ~pmask[g]) | pval[g];
+  }
+}
+
+
+/***** Set the direction of the GPIB control lines *****/
+/*
+    bits : 0=input pullup, 1=output
+    mask : 0=unaffected, 1=affected
+*/
+void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
+  uint8_t omask[8] = { 0 };
+  uint8_t imask[8] = { 0 };
+  for (uint8_t i=0; i<8; i++) {
+    if (mask & (1<<i)) {
+      if (bits & (1<<i)) {
+        omask[ctrlMap.bgrp[i]] |= ctrlMap.bmask[i];
+      }else{
+        imask[ctrlMap.bgrp[i]] |= ctrlMap.bmask[i];
+      }
+    }
+  }
+  for (uint8_t g=0; g<ctrlMap.ngrp; g++) {
+    if (omask[g]) *ctrlMap.grp[g].ddr |= omask[g];
+    if (imask[g]) {
+      *ctrlMap.grp[g].ddr &= ~imask[g];
+      *ctrlMap.grp[g].port |= imask[g];
+    }
+  }
+}
+
+
+#elif defined(ARDUINO_ARCH_RP2040)
+
+/*
+  RP2040: all pins sit in the single SIO bank so the maps are generated at
+  compile time from the pin defines. Pull-ups are enabled once and left on,
+  direction and level are then set with masked bank writes.
+*/
+
+typedef GpioBank8<DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN> gpioDbBank;
+typedef GpioBank8<IFC_PIN, NDAC_PIN, NRFD_PIN, DAV_PIN, EOI_PIN, REN_PIN, SRQ_PIN, ATN_PIN> gpioCtrlBank;
+
+static_assert(gpioDbBank::isExact() && gpioCtrlBank::isExact(), "GPIB pins must be distinct GPIO bank pins");
+static_assert((gpioDbBank::mask & gpioCtrlBank::mask) == 0, "Data and control pins overlap");
+
+
+/***** Initialise all GPIB pins as input pullup *****/
+void initGpibPins() {
+  uint32_t gpiomask = gpioDbBank::mask | gpioCtrlBank::mask;
+  gpio_init_mask(gpiomask);
+  gpio_set_dir_in_masked(gpiomask);
+  for (uint8_t i=0; i<8; i++) {
+    gpio_pull_up(databus[i]);
+    gpio_pull_up(ctrlbus[i]);
+  }
+}
+
+
+/***** Set the GPIB data bus to input pullup *****/
+void readyGpibDbus() {
+  gpio_set_dir_in_masked(gpioDbBank::mask);
+}
+
+
+/***** Read the GPIB data bus wires to collect the byte of data *****/
+uint8_t readGpibDbus() {
+  return (uint8_t)~gpioDbBank::gather(gpio_get_all());
+}
+
+
+/***** Set the GPIB data bus to output and with the requested byte *****/
+void setGpibDbus(uint8_t db) {
+  gpio_put_masked(gpioDbBank::mask, gpioDbBank::scatter((uint8_t)~db));
+  gpio_set_dir_out_masked(gpioDbBank::mask);
+}
+
+
+/***** Set the state of the GPIB control lines *****/
+void setGpibCtrlState(uint8_t bits, uint8_t mask) {
+  gpio_put_masked(gpioCtrlBank::scatter(mask), gpioCtrlBank::scatter(bits & mask));
+}
+
+
+/***** Set the direction of the GPIB control lines *****/
+void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
+  uint32_t gpioOmask = gpioCtrlBank::scatter(bits & mask);
+  uint32_t gpioImask = gpioCtrlBank::scatter((uint8_t)~bits & mask);
+  if (gpioOmask) gpio_set_dir_out_masked(gpioOmask);
+  if (gpioImask) gpio_set_dir_in_masked(gpioImask);
+}
+
+
+#elif defined(ESP32)
+
+/*
+  ESP32: the pins of each bus are reduced to a bit mask per GPIO register
+  bank at startup. Levels and directions are then set through the W1TS/W1TC
+  registers and the bus is read with one GPIO_IN read per bank. pinMode()
+  at startup selects the GPIO function and enables the pull-ups.
+*/
+
+#include <soc/gpio_reg.h>
+
+struct espBusMap {
+  uint32_t mask[2];
+  uint8_t pin[8];
+};
+
+espBusMap dbMap;
+espBusMap ctrlMap;
+
+
+/***** Reduce the pins of a bus to bank masks *****/
+void espMapBus(espBusMap &map, const uint8_t bus[]) {
+  map.mask[0] = 0;
+  map.mask[1] = 0;
+  for (uint8_t i=0; i<8; i++) {
+    map.pin[i] = bus[i];
+    map.mask[bus[i]>>5] |= (1UL << (bus[i] & 0x1F));
+  }
+}
+
+
+/***** Bus value to bank bits *****/
+void espScatter(const espBusMap &map, uint8_t bval, uint32_t bank[2]) {
+  bank[0] = 0;
+  bank[1] = 0;
+  for (uint8_t i=0; i<8; i++) {
+    if (bval & (1<<i)) bank[map.pin[i]>>5] |= (1UL << (map.pin[i] & 0x1F));
+  }
+}
+
+
+/***** Set the bits of both banks through a W1TS/W1TC register pair *****/
+inline void espWrite(uint32_t reg0, uint32_t reg1, const uint32_t bank[2]) {
+  if (bank[0]) REG_WRITE(reg0, bank[0]);
+  if (bank[1]) REG_WRITE(reg1, bank[1]);
+}
+
+
+/***** Initialise the bank masks and set all GPIB pins to input pullup *****/
+void initGpibPins() {
+  espMapBus(dbMap, databus);
+  espMapBus(ctrlMap, ctrlbus);
+  for (uint8_t i=0; i<8; i++) {
+    pinMode(databus[i], INPUT_PULLUP);
+    pinMode(ctrlbus[i], INPUT_PULLUP);
+  }
+}
+
+
+/***** Set the GPIB data bus to input pullup *****/
+void readyGpibDbus() {
+  espWrite(GPIO_ENABLE_W1TC_REG, GPIO_ENABLE1_W1TC_REG, dbMap.mask);
+}
+
+
+/***** Read the GPIB data bus wires to collect the byte of data *****/
+uint8_t readGpibDbus() {
+  uint32_t bank[2] = { REG_READ(GPIO_IN_REG), REG_READ(GPIO_IN1_REG) };
+  uint8_t db = 0;
+  for (uint8_t i=0; i<8; i++) {
+    if ( !(bank[dbMap.pin[i]>>5] & (1UL << (dbMap.pin[i] & 0x1F))) ) db |= (1<<i);
+  }
+  return db;
+}
+
+
+/***** Set the GPIB data bus to output and with the requested byte *****/
+void setGpibDbus(uint8_t db) {
+  uint32_t high[2];
+  uint32_t low[2];
+  espScatter(dbMap, ~db, high);
+  espScatter(dbMap, db, low);
+  espWrite(GPIO_OUT_W1TS_REG, GPIO_OUT1_W1TS_REG, high);
+  espWrite(GPIO_OUT_W1TC_REG, GPIO_OUT1_W1TC_REG, low);
+  espWrite(GPIO_ENABLE_W1TS_REG, GPIO_ENABLE1_W1TS_REG, dbMap.mask);
+}
+
+
+/***** Set the state of the GPIB control lines *****/
+void setGpibCtrlState(uint8_t bits, uint8_t mask) {
+  uint32_t high[2];
+  uint32_t low[2];
+  espScatter(ctrlMap, bits & mask, high);
+  espScatter(ctrlMap, ~bits & mask, low);
+  espWrite(GPIO_OUT_W1TS_REG, GPIO_OUT1_W1TS_REG, high);
+  espWrite(GPIO_OUT_W1TC_REG, GPIO_OUT1_W1TC_REG, low);
+}
+
+
+/***** Set the direction of the GPIB control lines *****/
+void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
+  uint32_t outs[2];
+  uint32_t ins[2];
+  espScatter(ctrlMap, bits & mask, outs);
+  espScatter(ctrlMap, ~bits & mask, ins);
+  espWrite(GPIO_ENABLE_W1TS_REG, GPIO_ENABLE1_W1TS_REG, outs);
+  espWrite(GPIO_ENABLE_W1TC_REG, GPIO_ENABLE1_W1TC_REG, ins);
+}
+
+
+#else
+
+/***** Set all GPIB pins to input pullup *****/
+void initGpibPins() {
+  for (uint8_t i=0; i<8; i++) {
+    pinMode(databus[i], INPUT_PULLUP);
+    pinMode(ctrlbus[i], INPUT_PULLUP);
+  }
+}
+
+
 /***** Set the GPIB data bus to input pullup *****/
 void readyGpibDbus() {
   for (uint8_t i=0; i<8; i++){
@@ -1958,6 +2478,8 @@ void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
 
 }
 
+#endif // Architecture
+
 #endif
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** CUSTOM PIN LAYOUT SECTION *****/
@@ -1999,6 +2521,52 @@ uint8_t getGpibPinState(uint8_t pin){
 
 #endif
 
+
+#ifdef DEVICE_ATN_INTERRUPT
+#ifdef ESP32
+
+#include <soc/gpio_reg.h>
+
+/***** Assert NRFD and NDAC from the ATN interrupt *****/
+/*
+ * Register writes only and placed in IRAM: the flash cache may be
+ * disabled when ATN falls, e.g. during an EEPROM commit.
+ */
+void IRAM_ATTR holdGpibHandshake(){
+  constexpr uint64_t hshk = (1ULL << NRFD_PIN) | (1ULL << NDAC_PIN);
+  if ((uint32_t)hshk) {
+    REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t)hshk);
+    REG_WRITE(GPIO_ENABLE_W1TS_REG, (uint32_t)hshk);
+  }
+  if ((uint32_t)(hshk >> 32)) {
+    REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t)(hshk >> 32));
+    REG_WRITE(GPIO_ENABLE1_W1TS_REG, (uint32_t)(hshk >> 32));
+  }
+}
+
+#else
+
+/***** Assert NRFD and NDAC from the ATN interrupt *****/
+void holdGpibHandshake(){
+  // NRFD = bit 2, NDAC = bit 1: asserted (LOW) first, then outputs
+  setGpibCtrlState(0x00, 0x06);
+  setGpibCtrlDir(0x06, 0x06);
+}
+
+#endif
+#endif
+
+
+#ifndef GPIB_DBUS_CTRL_WRITE
+
+/***** Data bus and control lines written one after the other *****/
+void setGpibDbusCtrl(uint8_t db, uint8_t bits, uint8_t mask){
+  setGpibDbus(db);
+  if (mask) setGpibCtrlState(bits, mask);
+}
+
+#endif
+
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** COMMON FUNCTIONS SECTION *****/
 /************************************/
@@ -132,24 +132,24 @@
 #ifdef AR488_MEGA2560_E2
 
 // NOTE: MEGA2560 pinout last updated 28/07/2019
-#define DIO1_PIN  37  /* GPIB 1  : PORTA bit 1 */
-#define DIO2_PIN  35  /* GPIB 2  : PORTA bit 3 */
-#define DIO3_PIN  33  /* GPIB 3  : PORTA bit 5 */
-#define DIO4_PIN  31  /* GPIB 4  : PORTA bit 7 */
-#define DIO5_PIN  29  /* GPIB 13 : PORTC bit 6 */
-#define DIO6_PIN  27  /* GPIB 14 : PORTC bit 4 */
-#define DIO7_PIN  25  /* GPIB 15 : PORTC bit 2 */
-#define DIO8_PIN  23  /* GPIB 16 : PORTC bit 0 */
-
-#define IFC_PIN   49  /* GPIB 9  : PORTG bit 0 */
-#define NDAC_PIN  47  /* GPIB 8  : PORTG bit 2 */
-#define NRFD_PIN  45  /* GPIB 7  : PORTL bit 6 */
-#define DAV_PIN   43  /* GPIB 6  : PORTL bit 4 */
-#define EOI_PIN   41  /* GPIB 5  : PORTL bit 2 */
-#define REN_PIN   39  /* GPIB 17 : PORTL bit 0 */
-
-#define SRQ_PIN   51  /* GPIB 10 : PORTB bit 0 */
-#define ATN_PIN   53  /* GPIB 11 : PORTB bit 2 */
+#define DIO1_PIN  37  /* GPIB 1  : PORTC bit 0 */
+#define DIO2_PIN  35  /* GPIB 2  : PORTC bit 2 */
+#define DIO3_PIN  33  /* GPIB 3  : PORTC bit 4 */
+#define DIO4_PIN  31  /* GPIB 4  : PORTC bit 6 */
+#define DIO5_PIN  29  /* GPIB 13 : PORTA bit 7 */
+#define DIO6_PIN  27  /* GPIB 14 : PORTA bit 5 */
+#define DIO7_PIN  25  /* GPIB 15 : PORTA bit 3 */
+#define DIO8_PIN  23  /* GPIB 16 : PORTA bit 1 */
+
+#define IFC_PIN   49  /* GPIB 9  : PORTL bit 0 */
+#define NDAC_PIN  47  /* GPIB 8  : PORTL bit 2 */
+#define NRFD_PIN  45  /* GPIB 7  : PORTL bit 4 */
+#define DAV_PIN   43  /* GPIB 6  : PORTL bit 6 */
+#define EOI_PIN   41  /* GPIB 5  : PORTG bit 0 */
+#define REN_PIN   39  /* GPIB 17 : PORTG bit 2 */
+
+#define SRQ_PIN   51  /* GPIB 10 : PORTB bit 2 */
+#define ATN_PIN   53  /* GPIB 11 : PORTB bit 0 */
 
 #endif  // AR488_MEGA2560_E2
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
@@ -212,8 +212,6 @@
 #define REN_PIN    3  /* GPIB 17 : PORTD bit 0 */
 #define ATN_PIN    7  /* GPIB 11 : PORTE bit 6 */
 
-uint8_t reverseBits(uint8_t dbyte);
-
 #endif // AR488_MEGA32U4_LR3
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** LEONARDO R3 LAYOUT DEFINITION *****/
@@ -257,6 +255,10 @@ uint8_t reverseBits(uint8_t dbyte);
 #define MCPPORTA 0x12
 #define MCPPORTB 0x13
 
+// Output latch register
+#define MCPOLATA 0x14
+#define MCPOLATB 0x15
+
 // Interrupt registers
 #define MCPINTENA 0x04    // Enable pin for interrupt on change (GPINTEN)
 #define MCPINTCONA 0x08   // Configure interrupt: 0 = compare against previous; 1 = compare against DEFVAL
@@ -271,6 +273,7 @@ uint8_t reverseBits(uint8_t dbyte);
 void mcpInit();
 uint8_t mcpByteRead(uint8_t reg);
 void mcpByteWrite(uint8_t reg, uint8_t db);
+void mcpWordWrite(uint8_t reg, uint8_t dba, uint8_t dbb);
 uint8_t mcpDigitalRead(uint8_t pin);
 void mcpInterruptsEn();
 void mcpIntHandler();
@@ -351,28 +354,27 @@ uint8_t getMcpIntAReg();
 /***** vvvvvvvvvvvvvvvvvvvvvvvvv *****/
 #ifdef POE_ETHERNET_GPIB_ADAPTOR
 
-uint8_t reverseBits(uint8_t dbyte);
-uint8_t readPortPullupReg(PORT_t port);
-void setPortPullupBits(PORT_t port, uint8_t reg);
+uint8_t readPortPullupReg(PORT_t &port);
+void setPortPullupBits(PORT_t &port, uint8_t reg);
 
 /***** KOFEN's POE Ethernet Gpib Adaptor pinout *****/
 #define DIO1_PIN  22  /* GPIB 1  : PORTD bit 0 */
 #define DIO2_PIN  23  /* GPIB 2  : PORTD bit 1 */
 #define DIO3_PIN  24  /* GPIB 3  : PORTD bit 2 */
-#define DIO4_PIN  24  /* GPIB 4  : PORTD bit 3 */
+#define DIO4_PIN  25  /* GPIB 4  : PORTD bit 3 */
 #define DIO5_PIN  26  /* GPIB 13 : PORTD bit 4 */
 #define DIO6_PIN  27  /* GPIB 14 : PORTD bit 5 */
-#define DIO7_PIN  28  /* GPIB 15 : PORTD bit 4 */
-#define DIO8_PIN  29  /* GPIB 16 : PORTD bit 5 */
-
-#define IFC_PIN   18  /* GPIB 9  : PORTC bit 0 */
-#define NDAC_PIN  17  /* GPIB 8  : PORTC bit 1 */
-#define NRFD_PIN  16  /* GPIB 8  : PORTC bit 2 */
-#define DAV_PIN   15  /* GPIB 6  : PORTC bit 3 */
-#define EOI_PIN   14  /* GPIB 5  : PORTC bit 4 */
-#define REN_PIN   21  /* GPIB 17 : PORTC bit 5 */
-#define SRQ_PIN   19  /* GPIB 10 : PORTC bit 6 */
-#define ATN_PIN   20  /* GPIB 11 : PORTC bit 7 */
+#define DIO7_PIN  28  /* GPIB 15 : PORTD bit 6 */
+#define DIO8_PIN  29  /* GPIB 16 : PORTD bit 7 */
+
+#define IFC_PIN   18  /* GPIB 9  : PORTC bit 4 */
+#define NDAC_PIN  17  /* GPIB 8  : PORTC bit 3 */
+#define NRFD_PIN  16  /* GPIB 7  : PORTC bit 2 */
+#define DAV_PIN   15  /* GPIB 6  : PORTC bit 1 */
+#define EOI_PIN   14  /* GPIB 5  : PORTC bit 0 */
+#define REN_PIN   21  /* GPIB 17 : PORTC bit 7 */
+#define SRQ_PIN   19  /* GPIB 10 : PORTC bit 5 */
+#define ATN_PIN   20  /* GPIB 11 : PORTC bit 6 */
 
 #endif  // POE_ETHERNET_GPIB_ADAPTOR
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
@@ -751,8 +753,7 @@ void gpioFuncList();
 #include <esp32/rom/gpio.h>
 #include <hal/gpio_hal.h>
 #include <soc/soc.h>
-
-unsigned long setRegisterMask(const uint8_t bus[]);
+#include <soc/gpio_reg.h>
 
 #endif  // ESP32_FUNCTIONS
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
@@ -761,6 +762,101 @@ unsigned long setRegisterMask(const uint8_t bus[]);
 
 
 
+/*****************************/
+/***** GPIO BANK PIN MAP *****/
+/***** vvvvvvvvvvvvvvvvv *****/
+#if defined(ARDUINO_ARCH_RP2040) || defined(RAS_PICO_L1) || defined(RAS_PICO_L2) || defined(RPI_NANO_RP2040) || defined(ESP32_FUNCTIONS)
+/*
+  Compile time map between an 8-bit bus value and the pins of a GPIO
+  bank (32-bit on RP2040, T=uint64_t spans both ESP32 register banks).
+  Bit n of the value (DIO1-DIO8, or control bits IFC-ATN) is carried by
+  pin Pn. Consecutive ascending pins reduce to a single shift, any other
+  order moves each bit with a constant shift. Everything is constexpr so
+  the masks can be checked with static_assert against the layout's pin
+  defines.
+*/
+template <uint8_t P0, uint8_t P1, uint8_t P2, uint8_t P3, uint8_t P4, uint8_t P5, uint8_t P6, uint8_t P7, typename T = uint32_t>
+struct GpioBank8 {
+
+  // GPIO bank bits used by the bus
+  static constexpr T mask = ((T)1<<P0) | ((T)1<<P1) | ((T)1<<P2) | ((T)1<<P3) |
+                            ((T)1<<P4) | ((T)1<<P5) | ((T)1<<P6) | ((T)1<<P7);
+
+  // Pins are consecutive and ascending from P0
+  static constexpr bool contiguous = (P1==P0+1) && (P2==P0+2) && (P3==P0+3) &&
+                                     (P4==P0+4) && (P5==P0+5) && (P6==P0+6) && (P7==P0+7);
+
+  // Bus value to GPIO bank bits
+  static constexpr T scatter(uint8_t bval) {
+    return contiguous ? ((T)bval << P0) :
+      ( ((T)( bval       & 1) << P0) | ((T)((bval >> 1) & 1) << P1) |
+        ((T)((bval >> 2) & 1) << P2) | ((T)((bval >> 3) & 1) << P3) |
+        ((T)((bval >> 4) & 1) << P4) | ((T)((bval >> 5) & 1) << P5) |
+        ((T)((bval >> 6) & 1) << P6) | ((T)((bval >> 7) & 1) << P7) );
+  }
+
+  // GPIO bank bits to bus value
+  static constexpr uint8_t gather(T gval) {
+    return contiguous ? (uint8_t)(gval >> P0) :
+      (uint8_t)( ((gval >> P0) & 1)        | (((gval >> P1) & 1) << 1) |
+                 (((gval >> P2) & 1) << 2) | (((gval >> P3) & 1) << 3) |
+                 (((gval >> P4) & 1) << 4) | (((gval >> P5) & 1) << 5) |
+                 (((gval >> P6) & 1) << 6) | (((gval >> P7) & 1) << 7) );
+  }
+
+  // Every bus value maps into the mask and back unchanged
+  static constexpr bool isExact(uint16_t bval = 0) {
+    return (bval > 0xFF) ||
+      ( ((scatter(bval) & ~mask) == 0) && (gather(scatter(bval)) == bval) && isExact(bval + 1) );
+  }
+
+  // Mapping equals a plain shift by offset for every bus value
+  static constexpr bool isShift(uint8_t offset, uint16_t bval = 0) {
+    return (bval > 0xFF) ||
+      ( (scatter(bval) == ((T)bval << offset)) &&
+        (gather((T)bval << offset) == bval) && isShift(offset, bval + 1) );
+  }
+
+};
+
+#endif
+/***** ^^^^^^^^^^^^^^^^^ *****/
+/***** GPIO BANK PIN MAP *****/
+/*****************************/
+
+
+
+/**********************************/
+/***** LOOKUP TABLE GENERATOR *****/
+/***** vvvvvvvvvvvvvvvvvvvvvv *****/
+/*
+  LUT_n(F, i) expands to F(i), F(i+1) ... F(i+n-1), so layouts can build
+  their bit shuffling tables in flash at compile time from a per-entry
+  macro, e.g.:  const uint8_t tbl[256] PROGMEM = { LUT_256(REV8, 0) };
+*/
+#define LUT_4(F, i)    F(i), F((i)+1), F((i)+2), F((i)+3)
+#define LUT_16(F, i)   LUT_4(F, i), LUT_4(F, (i)+4), LUT_4(F, (i)+8), LUT_4(F, (i)+12)
+#define LUT_32(F, i)   LUT_16(F, i), LUT_16(F, (i)+16)
+#define LUT_64(F, i)   LUT_32(F, i), LUT_32(F, (i)+32)
+#define LUT_256(F, i)  LUT_64(F, i), LUT_64(F, (i)+64), LUT_64(F, (i)+128), LUT_64(F, (i)+192)
+
+// Bit order of a byte reversed
+#define REV8(v) (uint8_t)( (((v) & 0x01) << 7) | (((v) & 0x02) << 5) | (((v) & 0x04) << 3) | (((v) & 0x08) << 1) | \
+                           (((v) & 0x10) >> 1) | (((v) & 0x20) >> 3) | (((v) & 0x40) >> 5) | (((v) & 0x80) >> 7) )
+
+// Shared 256 entry bit reversal table
+extern const uint8_t revBitsTable[256] PROGMEM;
+
+inline uint8_t reverseBits(uint8_t dbyte) {
+  return pgm_read_byte(&revBitsTable[dbyte]);
+}
+
+/***** ^^^^^^^^^^^^^^^^^^^^^^ *****/
+/***** LOOKUP TABLE GENERATOR *****/
+/**********************************/
+
+
+
 /**************************************/
 /***** GLOBAL DEFINITIONS SECTION *****/
 /***** vvvvvvvvvvvvvvvvvvvvvvvvvv *****/
@@ -772,6 +868,17 @@ void setGpibDbus(uint8_t db);
 void setGpibCtrlState(uint8_t bits, uint8_t mask);
 void setGpibCtrlDir(uint8_t bits, uint8_t mask);
 uint8_t getGpibPinState(uint8_t pin);
+void setGpibDbusCtrl(uint8_t db, uint8_t bits, uint8_t mask);
+
+#ifdef DEVICE_ATN_INTERRUPT
+  // Called from the ATN interrupt (ESP32: runs from IRAM)
+  void holdGpibHandshake();
+#endif
+
+// Layouts that write the data bus and control lines in one operation
+#if defined(RAS_PICO_L1) || defined(RAS_PICO_L2) || defined(ESP32_DEVKIT1_WROOM_32) || defined(AR488_MCP23S17)
+  #define GPIB_DBUS_CTRL_WRITE
+#endif
 
 #ifdef LEVEL_SHIFTER
   void initLevelShifter();
@@ -782,6 +889,10 @@ uint8_t getGpibPinState(uint8_t pin);
   void initRpGpioPins();
 #endif
 
+#if defined(AR488_CUSTOM) || defined(NON_ARDUINO)
+  void initGpibPins();
+#endif
+
 
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** GLOBAL DEFINITIONS SECTION *****/
@@ -0,0 +1,366 @@
+#include <Arduino.h>
+#include "AR488_Config.h"
+#include "AR488_Pio.h"
+
+/***** AR488_Pio.cpp, ver. 0.01.01, 18/10/2026 *****/
+
+
+#ifdef PICO_PIO_HANDSHAKE
+
+#include "AR488_Layouts.h"
+#include <hardware/pio.h>
+#include <hardware/dma.h>
+#include <hardware/clocks.h>
+
+
+/***** PIO instruction encoding *****/
+/*
+ * Just the instructions used by the handshake programs. Encodings are
+ * checked against the words produced by pioasm.
+ */
+static constexpr uint16_t pioDelay(uint8_t d) { return (uint16_t)(d & 0x1F) << 8; }
+
+static constexpr uint16_t pioJmp(uint8_t addr) { return 0x0000 | (addr & 0x1F); }
+static constexpr uint16_t pioWaitGpio(uint8_t pol, uint8_t pin, uint8_t d = 0) { return 0x2000 | pioDelay(d) | ((pol & 1) << 7) | (pin & 0x1F); }
+static constexpr uint16_t pioInPins(uint8_t cnt) { return 0x4000 | (cnt & 0x1F); }
+static constexpr uint16_t pioOutPins(uint8_t cnt) { return 0x6000 | (cnt & 0x1F); }
+static constexpr uint16_t pioPushBlock() { return 0x8020; }
+static constexpr uint16_t pioPullBlock() { return 0x80A0; }
+static constexpr uint16_t pioSetPins(uint8_t val, uint8_t d = 0) { return 0xE000 | pioDelay(d) | (val & 0x1F); }
+static constexpr uint16_t pioSetPindirs(uint8_t val) { return 0xE080 | (val & 0x1F); }
+
+static_assert(pioWaitGpio(0, 17) == 0x2011, "wait 0 gpio 17");
+static_assert(pioWaitGpio(1, 16, 31) == 0x3f90, "wait 1 gpio 16 [31]");
+static_assert(pioInPins(13) == 0x400d, "in pins, 13");
+static_assert(pioOutPins(13) == 0x600d, "out pins, 13");
+static_assert(pioPushBlock() == 0x8020, "push block");
+static_assert(pioPullBlock() == 0x80a0, "pull block");
+static_assert(pioSetPins(2) == 0xe002, "set pins, 2");
+static_assert(pioSetPins(0, 31) == 0xff00, "set pins, 0 [31]");
+static_assert(pioSetPindirs(3) == 0xe083, "set pindirs, 3");
+static_assert(pioJmp(5) == 0x0005, "jmp 5");
+
+
+/***** Bus word layout *****/
+/*
+ * Data and EOI are moved as one word covering the pin range from the
+ * lowest to the highest of DIO1-DIO8 and EOI. Pins in the range that are
+ * not data or EOI are written as 1 (released) and ignored on input.
+ */
+typedef GpioBank8<DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN> pioDbBank;
+
+static constexpr uint8_t lowBit(uint32_t m, uint8_t b = 0) { return (m & (1UL << b)) ? b : lowBit(m, b + 1); }
+static constexpr uint8_t highBit(uint32_t m, uint8_t b = 31) { return (m & (1UL << b)) ? b : highBit(m, b - 1); }
+
+static constexpr uint32_t pioEoiBit = 1UL << EOI_PIN;
+static constexpr uint32_t pioBusMask = pioDbBank::mask | pioEoiBit;
+static constexpr uint8_t pioBusBase = lowBit(pioBusMask);
+static constexpr uint8_t pioBusCount = highBit(pioBusMask) - pioBusBase + 1;
+static constexpr uint32_t pioFillBits = (((1UL << pioBusCount) - 1) << pioBusBase) & ~pioBusMask;
+
+static_assert(pioDbBank::isExact(), "GPIB data pins must be distinct GPIO pins");
+static_assert(pioBusCount <= 16, "Data and EOI pins must fit a 16-bit PIO word");
+static_assert(NRFD_PIN == NDAC_PIN + 1, "Acceptor SET pins need NRFD next to NDAC");
+
+// Byte and EOI to source word (active low)
+static inline uint16_t pioBusWord(uint8_t db, bool eoi) {
+  return (uint16_t)((pioDbBank::scatter((uint8_t)~db) | (eoi ? 0 : pioEoiBit) | pioFillBits) >> pioBusBase);
+}
+
+
+/***** Source program *****/
+/*
+ * SET pin: DAV. OUT pins: data + EOI range. OSR shifts right.
+ * The delay on the NRFD wait gives 32 cycles of data settling time. The
+ * clock divider is set from the settling time in pioSourceStart().
+ */
+static const uint16_t pioSourceCode[] = {
+  pioPullBlock(),                  // 0: next byte
+  pioOutPins(pioBusCount),         // 1: data and EOI on the bus
+  pioWaitGpio(0, NDAC_PIN),        // 2: acceptors present
+  pioWaitGpio(1, NRFD_PIN, 31),    // 3: acceptors ready, settle
+  pioSetPins(0),                   // 4: assert DAV
+  pioWaitGpio(1, NDAC_PIN),        // 5: data accepted
+  pioSetPins(1),                   // 6: release DAV
+};
+
+static const struct pio_program pioSourceProg = {
+  .instructions = pioSourceCode,
+  .length = sizeof(pioSourceCode) / sizeof(pioSourceCode[0]),
+  .origin = -1,
+};
+
+
+/***** Acceptor program *****/
+/*
+ * SET pins: NDAC (bit 0), NRFD (bit 1). IN pins: data + EOI range.
+ * ISR shifts left so the sampled range lands in the low bits.
+ * One permit word is pulled for every byte accepted.
+ */
+static const uint16_t pioAcceptCode[] = {
+  pioPullBlock(),                  // 0: permit
+  pioSetPins(0b10),                // 1: NRFD high, NDAC low
+  pioWaitGpio(0, DAV_PIN),         // 2: data valid
+  pioInPins(pioBusCount),          // 3: sample data and EOI
+  pioSetPins(0b00),                // 4: NRFD low
+  pioPushBlock(),                  // 5: word to RX FIFO
+  pioSetPins(0b01),                // 6: NDAC high, data accepted
+  pioWaitGpio(1, DAV_PIN),         // 7: DAV released
+  pioSetPins(0b00),                // 8: NDAC low
+};
+
+static const struct pio_program pioAcceptProg = {
+  .instructions = pioAcceptCode,
+  .length = sizeof(pioAcceptCode) / sizeof(pioAcceptCode[0]),
+  .origin = -1,
+};
+
+
+/***** State *****/
+static PIO pioBlk = pio0;
+static bool pioLoaded = false;
+static uint pioSrcOffset;
+static uint pioAccOffset;
+static uint pioSrcSm;
+static uint pioAccSm;
+static int pioTxDma;
+static int pioPermitDma;
+
+static uint16_t pioTxBuf[2][PIO_TXBUF_SIZE];
+static uint16_t pioTxFill = 0;
+static uint8_t pioTxCur = 0;
+
+static bool pioFreeRun = false;
+static bool pioPermitOut = false;
+static const uint32_t pioPermitWord = 0;
+
+
+/***** Clock divider that makes 32 PIO cycles last settleUs *****/
+/*
+ * The shortest settling time is 32 system clock cycles.
+ */
+static float pioSettleDiv(uint16_t settleUs) {
+  float clkdiv = (float)clock_get_hz(clk_sys) * settleUs / 32000000.0f;
+  if (clkdiv < 1.0f) clkdiv = 1.0f;
+  if (clkdiv > 65535.0f) clkdiv = 65535.0f;
+  return clkdiv;
+}
+
+
+/***** Load programs and claim resources (once) *****/
+static void pioLoad() {
+  if (pioLoaded) return;
+
+  pio_sm_config c;
+
+  pioSrcOffset = pio_add_program(pioBlk, &pioSourceProg);
+  pioSrcSm = pio_claim_unused_sm(pioBlk, true);
+  c = pio_get_default_sm_config();
+  sm_config_set_wrap(&c, pioSrcOffset, pioSrcOffset + pioSourceProg.length - 1);
+  sm_config_set_out_pins(&c, pioBusBase, pioBusCount);
+  sm_config_set_set_pins(&c, DAV_PIN, 1);
+  sm_config_set_out_shift(&c, true, false, 32);
+  pio_sm_init(pioBlk, pioSrcSm, pioSrcOffset, &c);
+
+  pioAccOffset = pio_add_program(pioBlk, &pioAcceptProg);
+  pioAccSm = pio_claim_unused_sm(pioBlk, true);
+  c = pio_get_default_sm_config();
+  sm_config_set_wrap(&c, pioAccOffset, pioAccOffset + pioAcceptProg.length - 1);
+  sm_config_set_in_pins(&c, pioBusBase);
+  sm_config_set_set_pins(&c, NDAC_PIN, 2);
+  sm_config_set_in_shift(&c, false, false, 32);
+  pio_sm_init(pioBlk, pioAccSm, pioAccOffset, &c);
+
+  pioTxDma = dma_claim_unused_channel(true);
+  pioPermitDma = dma_claim_unused_channel(true);
+
+  pioLoaded = true;
+}
+
+
+/***** Return pins to the layout functions *****/
+static void pioReleasePins(uint32_t mask) {
+  for (uint8_t i = 0; i < 32; i++) {
+    if (mask & (1UL << i)) gpio_set_function(i, GPIO_FUNC_SIO);
+  }
+}
+
+
+/***** Hand pins to the PIO *****/
+static void pioClaimPins(uint32_t mask) {
+  for (uint8_t i = 0; i < 32; i++) {
+    if (mask & (1UL << i)) pio_gpio_init(pioBlk, i);
+  }
+}
+
+
+/***** Source handshake *****/
+
+void pioSourceStart(uint16_t settleUs) {
+  const uint32_t pins = pioBusMask | (1UL << DAV_PIN);
+  pioLoad();
+  pio_sm_set_enabled(pioBlk, pioSrcSm, false);
+  pio_sm_set_clkdiv(pioBlk, pioSrcSm, pioSettleDiv(settleUs));
+  pio_sm_clear_fifos(pioBlk, pioSrcSm);
+  pio_sm_restart(pioBlk, pioSrcSm);
+  pio_sm_exec(pioBlk, pioSrcSm, pioJmp(pioSrcOffset));
+  // All lines released before the PIO takes the pins
+  pio_sm_set_pins_with_mask(pioBlk, pioSrcSm, pins, pins);
+  pio_sm_set_pindirs_with_mask(pioBlk, pioSrcSm, pins, pins);
+  pioClaimPins(pins);
+  pioTxFill = 0;
+  pioTxCur = 0;
+  pio_sm_set_enabled(pioBlk, pioSrcSm, true);
+}
+
+
+// Add a byte to the current buffer. False while both buffers are busy.
+bool pioSourceQueue(uint8_t db, bool eoi) {
+  if (pioTxFill == PIO_TXBUF_SIZE) {
+    if (!pioSourceKick()) return false;
+  }
+  pioTxBuf[pioTxCur][pioTxFill++] = pioBusWord(db, eoi);
+  return true;
+}
+
+
+// Start DMA of the current buffer. False while the previous one is in flight.
+bool pioSourceKick() {
+  if (pioTxFill == 0) return true;
+  if (dma_channel_is_busy(pioTxDma)) return false;
+
+  dma_channel_config c = dma_channel_get_default_config(pioTxDma);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+  channel_config_set_read_increment(&c, true);
+  channel_config_set_write_increment(&c, false);
+  channel_config_set_dreq(&c, pio_get_dreq(pioBlk, pioSrcSm, true));
+  dma_channel_configure(pioTxDma, &c, &pioBlk->txf[pioSrcSm], pioTxBuf[pioTxCur], pioTxFill, true);
+
+  pioTxCur ^= 1;
+  pioTxFill = 0;
+  return true;
+}
+
+
+// All queued bytes handshaked and the state machine waiting for the next
+bool pioSourceIdle() {
+  if (pioTxFill) return false;
+  if (dma_channel_is_busy(pioTxDma)) return false;
+  if (!pio_sm_is_tx_fifo_empty(pioBlk, pioSrcSm)) return false;
+  return (pio_sm_get_pc(pioBlk, pioSrcSm) == pioSrcOffset);
+}
+
+
+// Changes whenever the source moves on: DMA count, TX FIFO level or program counter
+static uint32_t pioSourceProgress() {
+  return (dma_channel_hw_addr(pioTxDma)->transfer_count << 9)
+       | (pio_sm_get_tx_fifo_level(pioBlk, pioSrcSm) << 5)
+       | pio_sm_get_pc(pioBlk, pioSrcSm);
+}
+
+
+// Queue a byte, waiting for a free buffer. False after tmo ms without progress.
+bool pioSourceQueueWait(uint8_t db, bool eoi, unsigned long tmo) {
+  unsigned long startMillis = millis();
+  uint32_t progress = pioSourceProgress();
+  uint32_t now;
+
+  while (!pioSourceQueue(db, eoi)) {
+    now = pioSourceProgress();
+    if (now != progress) {
+      progress = now;
+      startMillis = millis();
+    }else if ((unsigned long)(millis() - startMillis) >= tmo) {
+      return false;
+    }
+  }
+  // Start DMA now if the previous buffer has gone
+  pioSourceKick();
+  return true;
+}
+
+
+// Send everything queued. False after tmo ms without progress.
+bool pioSourceFlush(unsigned long tmo) {
+  unsigned long startMillis = millis();
+  uint32_t progress = pioSourceProgress();
+  uint32_t now;
+
+  while (!pioSourceKick() || !pioSourceIdle()) {
+    now = pioSourceProgress();
+    if (now != progress) {
+      progress = now;
+      startMillis = millis();
+    }else if ((unsigned long)(millis() - startMillis) >= tmo) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+void pioSourceStop() {
+  dma_channel_abort(pioTxDma);
+  pio_sm_set_enabled(pioBlk, pioSrcSm, false);
+  pio_sm_clear_fifos(pioBlk, pioSrcSm);
+  pioReleasePins(pioBusMask | (1UL << DAV_PIN));
+  pioTxFill = 0;
+}
+
+
+/***** Acceptor handshake *****/
+
+// freeRun: permits are fed by DMA, bytes are accepted as fast as the RX FIFO drains
+void pioAcceptStart(bool freeRun) {
+  const uint32_t pins = (1UL << NDAC_PIN) | (1UL << NRFD_PIN);
+  pioLoad();
+  pio_sm_set_enabled(pioBlk, pioAccSm, false);
+  pio_sm_clear_fifos(pioBlk, pioAccSm);
+  pio_sm_restart(pioBlk, pioAccSm);
+  pio_sm_exec(pioBlk, pioAccSm, pioJmp(pioAccOffset));
+  // Not ready, not accepted
+  pio_sm_set_pins_with_mask(pioBlk, pioAccSm, 0, pins);
+  pio_sm_set_pindirs_with_mask(pioBlk, pioAccSm, pins, pins);
+  pioClaimPins(pins);
+  pio_sm_set_enabled(pioBlk, pioAccSm, true);
+
+  pioFreeRun = freeRun;
+  pioPermitOut = false;
+  if (freeRun) {
+    dma_channel_config c = dma_channel_get_default_config(pioPermitDma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pioBlk, pioAccSm, true));
+    dma_channel_configure(pioPermitDma, &c, &pioBlk->txf[pioAccSm], &pioPermitWord, 0x0FFFFFFF, true);
+  }
+}
+
+
+// Next byte from the RX FIFO. Issues the permit for it first if required.
+bool pioAcceptByte(uint8_t *db, bool *eoi) {
+  if (!pioFreeRun && !pioPermitOut) {
+    pio_sm_put(pioBlk, pioAccSm, pioPermitWord);
+    pioPermitOut = true;
+  }
+  if (pio_sm_is_rx_fifo_empty(pioBlk, pioAccSm)) return false;
+
+  uint32_t gpioall = pio_sm_get(pioBlk, pioAccSm) << pioBusBase;
+  pioPermitOut = false;
+  *db = (uint8_t)~pioDbBank::gather(gpioall);
+  *eoi = !(gpioall & pioEoiBit);
+  return true;
+}
+
+
+void pioAcceptStop() {
+  if (pioFreeRun) dma_channel_abort(pioPermitDma);
+  pio_sm_set_enabled(pioBlk, pioAccSm, false);
+  pio_sm_clear_fifos(pioBlk, pioAccSm);
+  pioReleasePins((1UL << NDAC_PIN) | (1UL << NRFD_PIN));
+  pioFreeRun = false;
+  pioPermitOut = false;
+}
+
+
+#endif  // PICO_PIO_HANDSHAKE
@@ -0,0 +1,50 @@
+#ifndef AR488_PIO_H
+#define AR488_PIO_H
+
+#include <Arduino.h>
+#include "AR488_Config.h"
+
+
+/***** AR488_Pio.h, ver. 0.01.01, 18/10/2026 *****/
+
+
+#ifdef PICO_PIO_HANDSHAKE
+
+/*
+ * GPIB source and acceptor handshakes in RP2040 PIO state machines.
+ *
+ * Source: 16-bit words (inverted data byte plus EOI) are moved from a
+ * RAM buffer to the TX FIFO by DMA. For each word the state machine puts
+ * data and EOI on the bus, waits for NDAC low / NRFD high, asserts DAV
+ * after settleUs and releases it once NDAC goes high.
+ *
+ * Acceptor: each word in the TX FIFO is a permit for one byte. The state
+ * machine raises NRFD, samples the data and EOI lines together when DAV
+ * goes low and pushes them as one word into the RX FIFO, so EOI stays
+ * attached to the byte it came with.
+ *
+ * pioSourceQueueWait() and pioSourceFlush() time out only when the source
+ * has not moved for tmo ms (DMA count, TX FIFO level and program counter
+ * all unchanged), so a long queue does not have to be sent within a
+ * single read timeout.
+ *
+ * Only the pins used by a running state machine are switched to the PIO.
+ * They go back to the layout (SIO) functions when the state machine stops.
+ */
+
+void pioSourceStart(uint16_t settleUs);
+bool pioSourceQueue(uint8_t db, bool eoi);
+bool pioSourceKick();
+bool pioSourceIdle();
+bool pioSourceQueueWait(uint8_t db, bool eoi, unsigned long tmo);
+bool pioSourceFlush(unsigned long tmo);
+void pioSourceStop();
+
+void pioAcceptStart(bool freeRun);
+bool pioAcceptByte(uint8_t *db, bool *eoi);
+void pioAcceptStop();
+
+#endif  // PICO_PIO_HANDSHAKE
+
+
+#endif  // AR488_PIO_H
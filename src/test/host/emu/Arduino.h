@@ -0,0 +1,70 @@
+#ifndef EMU_ARDUINO_H
+#define EMU_ARDUINO_H
+
+/***** Arduino.h for host tests *****/
+/*
+ * Just enough of the Arduino core for the firmware modules built by the
+ * host tests. millis() runs the emulated hardware (see pico_emu.h).
+ * With an AVR MCU macro the analog pin numbers follow that MCU's core and
+ * the port registers come from avr/io.h.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define F(s) (s)
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328PB__)
+#define A0 14
+#elif defined(__AVR_ATmega32U4__)
+#define A0 18
+#elif defined(__AVR_ATmega2560__)
+#define A0 54
+#elif defined(__AVR_ATmega644P__)
+#define A0 24
+#elif defined(__AVR_ATmega4809__)
+#define A0 22
+#else
+#define A0 26
+#endif
+
+#define A1 (A0 + 1)
+#define A2 (A0 + 2)
+#define A3 (A0 + 3)
+#define A4 (A0 + 4)
+#define A5 (A0 + 5)
+#define A6 (A0 + 6)
+#define A7 (A0 + 7)
+
+#ifdef __AVR__
+#include <avr/io.h>
+#endif
+
+unsigned long millis();
+int digitalRead(uint8_t pin);
+
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  virtual void flush() {}
+};
+
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+#endif  // EMU_ARDUINO_H
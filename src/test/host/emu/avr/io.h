@@ -0,0 +1,37 @@
+#ifndef EMU_AVR_IO_H
+#define EMU_AVR_IO_H
+
+/***** avr/io.h for host tests *****/
+/*
+ * The I/O port registers as plain variables, defined by the test. Classic
+ * AVRs get PINx, DDRx and PORTx for ports A to L. The megaAVR 0-series
+ * (__AVR_XMEGA__, e.g. the 4809) gets PORT_t structures for ports A to F.
+ */
+
+#include <stdint.h>
+
+#ifdef __AVR_XMEGA__
+
+typedef volatile uint8_t register8_t;
+
+struct PORT_t {
+  register8_t DIR;
+  register8_t OUT;
+  register8_t IN;
+  register8_t PIN0CTRL, PIN1CTRL, PIN2CTRL, PIN3CTRL, PIN4CTRL, PIN5CTRL, PIN6CTRL, PIN7CTRL;
+};
+
+#define PORT_PULLUPEN_bm 0x08
+
+extern PORT_t PORTA, PORTB, PORTC, PORTD, PORTE, PORTF;
+
+#else
+
+#define EMU_AVR_PORT(x) extern volatile uint8_t PIN##x, DDR##x, PORT##x;
+EMU_AVR_PORT(A) EMU_AVR_PORT(B) EMU_AVR_PORT(C) EMU_AVR_PORT(D) EMU_AVR_PORT(E) EMU_AVR_PORT(F)
+EMU_AVR_PORT(G) EMU_AVR_PORT(H) EMU_AVR_PORT(J) EMU_AVR_PORT(K) EMU_AVR_PORT(L)
+#undef EMU_AVR_PORT
+
+#endif
+
+#endif  // EMU_AVR_IO_H
@@ -0,0 +1,6 @@
+#ifndef EMU_HARDWARE_CLOCKS_H
+#define EMU_HARDWARE_CLOCKS_H
+
+#include "pico_emu.h"
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef EMU_HARDWARE_PIO_H
+#define EMU_HARDWARE_PIO_H
+
+#include "pico_emu.h"
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef PICO_EMU_H
+#define PICO_EMU_H
+
+/***** RP2040 PIO/DMA emulator for host tests *****/
+/*
+ * Implements the pico-sdk calls used by AR488_Pio.cpp on an emulated
+ * RP2040 clocked at 125MHz: one PIO block with four state machines, DMA
+ * channels paced by the PIO TX DREQs and the GPIO function select.
+ *
+ * Up to EMU_CHIPS RP2040s share one GPIB bus. A translation unit selects
+ * the chip its SDK calls go to with EMU_CHIP, so AR488_Pio.cpp can be
+ * included once per chip (each in its own namespace) to put a source and
+ * an acceptor on opposite ends of the bus. A pin reads low when any chip
+ * driving it through its PIO, or the test peer, pulls it low.
+ *
+ * Only the PIO instructions used by the handshake programs are executed
+ * (jmp always, wait gpio, in/out pins, push/pull, set pins/pindirs).
+ * Anything else aborts the test. OUT to a pin range writes every pin in
+ * the range, as on the real device, so a chip must not run the source and
+ * the acceptor at the same time.
+ *
+ * Time only moves while the code under test polls: every FIFO, DMA or PC
+ * query and every millis() call runs the emulation for EMU_POLL_CYCLES.
+ */
+
+#include <stdint.h>
+
+#define EMU_CHIPS 2
+#define EMU_POLL_CYCLES 8
+#define EMU_CLK_HZ 125000000UL
+
+#ifndef EMU_CHIP
+#define EMU_CHIP 0
+#endif
+
+typedef unsigned int uint;
+
+
+/***** PIO *****/
+
+struct pio_hw_t {
+  volatile uint32_t txf[4];   // Only used as DMA write addresses
+  volatile uint32_t rxf[4];
+};
+typedef pio_hw_t *PIO;
+
+struct pio_program {
+  const uint16_t *instructions;
+  uint8_t length;
+  int8_t origin;
+};
+
+struct pio_sm_config {
+  uint8_t wrapBottom, wrapTop;
+  uint8_t outBase, outCount;
+  uint8_t setBase, setCount;
+  uint8_t inBase;
+  bool outRight, inRight;
+  float clkdiv;
+};
+
+PIO emuPio(int chip);
+#define pio0 (emuPio(EMU_CHIP))
+
+uint pio_add_program(PIO pio, const pio_program *prog);
+uint pio_claim_unused_sm(PIO pio, bool required);
+uint pio_get_dreq(PIO pio, uint sm, bool isTx);
+void pio_gpio_init(PIO pio, uint pin);
+
+pio_sm_config pio_get_default_sm_config();
+void sm_config_set_wrap(pio_sm_config *c, uint bottom, uint top);
+void sm_config_set_out_pins(pio_sm_config *c, uint base, uint count);
+void sm_config_set_set_pins(pio_sm_config *c, uint base, uint count);
+void sm_config_set_in_pins(pio_sm_config *c, uint base);
+void sm_config_set_out_shift(pio_sm_config *c, bool shiftRight, bool autopull, uint threshold);
+void sm_config_set_in_shift(pio_sm_config *c, bool shiftRight, bool autopush, uint threshold);
+
+void pio_sm_init(PIO pio, uint sm, uint initialPc, const pio_sm_config *c);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+void pio_sm_restart(PIO pio, uint sm);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t values, uint32_t mask);
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t dirs, uint32_t mask);
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm);
+uint8_t pio_sm_get_pc(PIO pio, uint sm);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get(PIO pio, uint sm);
+
+
+/***** GPIO *****/
+
+enum gpio_function { GPIO_FUNC_SIO = 5, GPIO_FUNC_PIO0 = 6 };
+
+void emu_gpio_set_function(int chip, uint pin, enum gpio_function fn);
+#define gpio_set_function(pin, fn) emu_gpio_set_function(EMU_CHIP, pin, fn)
+
+
+/***** DMA *****/
+
+struct dma_channel_config {
+  uint8_t size;
+  bool readIncrement, writeIncrement;
+  uint dreq;
+};
+
+struct dma_channel_hw_t {
+  volatile uint32_t transfer_count;
+};
+
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+
+int emu_dma_claim_unused_channel(int chip, bool required);
+dma_channel_config emu_dma_channel_get_default_config(int chip, uint ch);
+void emu_dma_channel_configure(int chip, uint ch, const dma_channel_config *c, volatile void *writeAddr, const volatile void *readAddr, uint count, bool trigger);
+bool emu_dma_channel_is_busy(int chip, uint ch);
+void emu_dma_channel_abort(int chip, uint ch);
+dma_channel_hw_t *emu_dma_channel_hw_addr(int chip, uint ch);
+
+#define dma_claim_unused_channel(req) emu_dma_claim_unused_channel(EMU_CHIP, req)
+#define dma_channel_get_default_config(ch) emu_dma_channel_get_default_config(EMU_CHIP, ch)
+#define dma_channel_configure(ch, c, w, r, n, t) emu_dma_channel_configure(EMU_CHIP, ch, c, w, r, n, t)
+#define dma_channel_is_busy(ch) emu_dma_channel_is_busy(EMU_CHIP, ch)
+#define dma_channel_abort(ch) emu_dma_channel_abort(EMU_CHIP, ch)
+#define dma_channel_hw_addr(ch) emu_dma_channel_hw_addr(EMU_CHIP, ch)
+
+
+/***** Clocks *****/
+
+enum clock_index { clk_sys = 5 };
+
+uint32_t clock_get_hz(enum clock_index clk);
+
+
+/***** Emulator control for the tests *****/
+
+// System clock cycles since start
+uint64_t emuCycles();
+
+// Run the bus for a number of cycles
+void emuRun(uint64_t cycles);
+
+// Test peer: called every cycle, may drive lines with emuPeerDrive()
+void emuSetPeer(void (*peer)());
+void emuPeerDrive(uint8_t pin, bool low);
+void emuPeerRelease();
+
+// Bus line level seen by all chips (true = high / released)
+bool emuLine(uint8_t pin);
+
+// Pin function on a chip
+enum gpio_function emuPinFunction(int chip, uint pin);
+
+#endif  // PICO_EMU_H
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <Arduino.h>
+#include "AR488_Config.h"
+
+/***** layout_test.cpp - AVR port code against the pin numbers of the layout *****/
+/*
+ * Built once per AVR layout by run.sh, with the MCU macro of the board and
+ * TEST_<layout> naming the layout under test. The hand-written register
+ * code of the layout in AR488_Layouts.cpp is checked bit by bit against a
+ * model built from the pin numbers in AR488_Layouts.h and the Arduino core
+ * pin table of the MCU, for every data byte and every control bits/mask
+ * pair. A register bit the layout does not own must never change.
+ */
+
+// AR488_Config.h picks the default layout of the MCU, run.sh names the one under test
+#undef AR488_UNO
+#undef AR488_NANO
+#undef AR488_MCP23S17
+#undef AR488_328PB_ALT
+#undef AR488_MEGA32U4_MICRO
+#undef AR488_MEGA32U4_LR3
+#undef AR488_MEGA2560_D
+#undef AR488_MEGA2560_E1
+#undef AR488_MEGA2560_E2
+#undef AR488_MEGA644P_MCGRAW
+#undef POE_ETHERNET_GPIB_ADAPTOR
+
+#if defined(TEST_AR488_UNO)
+  #define AR488_UNO
+  #define LAYOUT_NAME "AR488_UNO"
+#elif defined(TEST_AR488_NANO)
+  #define AR488_NANO
+  #define LAYOUT_NAME "AR488_NANO"
+#elif defined(TEST_AR488_328PB_ALT)
+  #define AR488_328PB_ALT
+  #define LAYOUT_NAME "AR488_328PB_ALT"
+#elif defined(TEST_AR488_MEGA32U4_MICRO)
+  #define AR488_MEGA32U4_MICRO
+  #define LAYOUT_NAME "AR488_MEGA32U4_MICRO"
+#elif defined(TEST_AR488_MEGA32U4_LR3)
+  #define AR488_MEGA32U4_LR3
+  #define LAYOUT_NAME "AR488_MEGA32U4_LR3"
+#elif defined(TEST_AR488_MEGA2560_D)
+  #define AR488_MEGA2560_D
+  #define LAYOUT_NAME "AR488_MEGA2560_D"
+#elif defined(TEST_AR488_MEGA2560_E1)
+  #define AR488_MEGA2560_E1
+  #define LAYOUT_NAME "AR488_MEGA2560_E1"
+#elif defined(TEST_AR488_MEGA2560_E2)
+  #define AR488_MEGA2560_E2
+  #define LAYOUT_NAME "AR488_MEGA2560_E2"
+#elif defined(TEST_AR488_MEGA644P_MCGRAW)
+  #define AR488_MEGA644P_MCGRAW
+  #define LAYOUT_NAME "AR488_MEGA644P_MCGRAW"
+#elif defined(TEST_POE_ETHERNET_GPIB_ADAPTOR)
+  #define POE_ETHERNET_GPIB_ADAPTOR
+  #define LAYOUT_NAME "POE_ETHERNET_GPIB_ADAPTOR"
+#else
+  #error "No layout under test"
+#endif
+
+#include "AR488_Layouts.cpp"
+
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    failures++; \
+  } \
+} while (0)
+
+
+/***** Arduino core pin tables *****/
+
+struct PinRef {
+  char port;
+  uint8_t bit;
+};
+
+#define PORT8(p) {p,0},{p,1},{p,2},{p,3},{p,4},{p,5},{p,6},{p,7}
+#define PORT8R(p) {p,7},{p,6},{p,5},{p,4},{p,3},{p,2},{p,1},{p,0}
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328PB__)
+// UNO/Nano: D0-D7 PD, D8-D13 PB0-5, A0-A5 PC0-5, A6/A7 on PE2/PE3 of the 328PB
+static const PinRef corePins[] = {
+  PORT8('D'),
+  {'B',0},{'B',1},{'B',2},{'B',3},{'B',4},{'B',5},
+  {'C',0},{'C',1},{'C',2},{'C',3},{'C',4},{'C',5},
+  {'E',2},{'E',3},
+};
+#elif defined(__AVR_ATmega32U4__)
+// Leonardo/Micro
+static const PinRef corePins[] = {
+  {'D',2},{'D',3},{'D',1},{'D',0},{'D',4},{'C',6},{'D',7},{'E',6},
+  {'B',4},{'B',5},{'B',6},{'B',7},{'D',6},{'C',7},
+  {'B',3},{'B',1},{'B',2},{'B',0},
+  {'F',7},{'F',6},{'F',5},{'F',4},{'F',1},{'F',0},
+};
+#elif defined(__AVR_ATmega2560__)
+// Mega 2560
+static const PinRef corePins[] = {
+  {'E',0},{'E',1},{'E',4},{'E',5},{'G',5},{'E',3},{'H',3},{'H',4},
+  {'H',5},{'H',6},{'B',4},{'B',5},{'B',6},{'B',7},{'J',1},{'J',0},
+  {'H',1},{'H',0},{'D',3},{'D',2},{'D',1},{'D',0},
+  PORT8('A'), PORT8R('C'),
+  {'D',7},{'G',2},{'G',1},{'G',0},
+  PORT8R('L'),
+  {'B',3},{'B',2},{'B',1},{'B',0},
+  PORT8('F'), PORT8('K'),
+};
+#elif defined(__AVR_ATmega644P__)
+// MightyCore standard pinout
+static const PinRef corePins[] = { PORT8('B'), PORT8('D'), PORT8('C'), PORT8('A') };
+#elif defined(__AVR_ATmega4809__)
+// MegaCoreX 48 pin
+static const PinRef corePins[] = {
+  PORT8('A'),
+  {'B',0},{'B',1},{'B',2},{'B',3},{'B',4},{'B',5},
+  PORT8('C'), PORT8('D'),
+  {'E',0},{'E',1},{'E',2},{'E',3},
+  {'F',0},{'F',1},{'F',2},{'F',3},{'F',4},{'F',5},
+};
+#endif
+
+
+/***** Port registers *****/
+
+struct RegBit {
+  volatile uint8_t *reg;
+  uint8_t bit;
+};
+
+#ifdef __AVR_XMEGA__
+
+PORT_t PORTA, PORTB, PORTC, PORTD, PORTE, PORTF;
+
+static PORT_t *portOf(char p) {
+  static PORT_t *const ports[] = { &PORTA, &PORTB, &PORTC, &PORTD, &PORTE, &PORTF };
+  return ports[p - 'A'];
+}
+
+static RegBit inBit(uint8_t pin)   { const PinRef &r = corePins[pin]; return { &portOf(r.port)->IN, r.bit }; }
+static RegBit dirBit(uint8_t pin)  { const PinRef &r = corePins[pin]; return { &portOf(r.port)->DIR, r.bit }; }
+static RegBit outBit(uint8_t pin)  { const PinRef &r = corePins[pin]; return { &portOf(r.port)->OUT, r.bit }; }
+// PULLUPEN in PINnCTRL
+static RegBit pullBit(uint8_t pin) { const PinRef &r = corePins[pin]; return { &portOf(r.port)->PIN0CTRL + r.bit, 3 }; }
+
+#define REGS (6 * sizeof(PORT_t))
+
+static volatile uint8_t *regAt(int i) {
+  return (volatile uint8_t *)portOf('A' + i / sizeof(PORT_t)) + (i % sizeof(PORT_t));
+}
+
+#else
+
+#define EMU_AVR_PORT(x) volatile uint8_t PIN##x, DDR##x, PORT##x;
+EMU_AVR_PORT(A) EMU_AVR_PORT(B) EMU_AVR_PORT(C) EMU_AVR_PORT(D) EMU_AVR_PORT(E) EMU_AVR_PORT(F)
+EMU_AVR_PORT(G) EMU_AVR_PORT(H) EMU_AVR_PORT(J) EMU_AVR_PORT(K) EMU_AVR_PORT(L)
+#undef EMU_AVR_PORT
+
+// PIN, DDR and PORT of ports A to L (no port I)
+static volatile uint8_t *const portRegs[][3] = {
+  { &PINA, &DDRA, &PORTA }, { &PINB, &DDRB, &PORTB }, { &PINC, &DDRC, &PORTC }, { &PIND, &DDRD, &PORTD },
+  { &PINE, &DDRE, &PORTE }, { &PINF, &DDRF, &PORTF }, { &PING, &DDRG, &PORTG }, { &PINH, &DDRH, &PORTH },
+  { nullptr, nullptr, nullptr },
+  { &PINJ, &DDRJ, &PORTJ }, { &PINK, &DDRK, &PORTK }, { &PINL, &DDRL, &PORTL },
+};
+
+static RegBit pinReg(uint8_t pin, int which) {
+  const PinRef &r = corePins[pin];
+  return { portRegs[r.port - 'A'][which], r.bit };
+}
+
+static RegBit inBit(uint8_t pin)   { return pinReg(pin, 0); }
+static RegBit dirBit(uint8_t pin)  { return pinReg(pin, 1); }
+static RegBit outBit(uint8_t pin)  { return pinReg(pin, 2); }
+// Input pull-up is the PORT bit of an input
+static RegBit pullBit(uint8_t pin) { return pinReg(pin, 2); }
+
+#define REGS (12 * 3)
+
+static volatile uint8_t *regAt(int i) {
+  return portRegs[i / 3][i % 3];
+}
+
+#endif
+
+
+int digitalRead(uint8_t pin) {
+  const RegBit rb = inBit(pin);
+  return (*rb.reg >> rb.bit) & 1;
+}
+
+
+/***** Register snapshot and expected values *****/
+
+static uint8_t expected[REGS];
+static uint32_t seed = 0x2545F491;
+
+static uint8_t rnd() {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return (uint8_t)seed;
+}
+
+// Fill every register with random bits and expect them to stay
+static void scramble() {
+  for (int i = 0; i < (int)REGS; i++) {
+    volatile uint8_t *r = regAt(i);
+    if (!r) continue;
+    *r = rnd();
+    expected[i] = *r;
+  }
+}
+
+static void expectBit(RegBit rb, bool v) {
+  for (int i = 0; i < (int)REGS; i++) {
+    if (regAt(i) == rb.reg) {
+      if (v) {
+        expected[i] |= (1 << rb.bit);
+      }else{
+        expected[i] &= ~(1 << rb.bit);
+      }
+      return;
+    }
+  }
+  printf("  register for bit %d not found\n", rb.bit);
+  failures++;
+}
+
+static void setBit(RegBit rb, bool v) {
+  if (v) {
+    *rb.reg |= (1 << rb.bit);
+  }else{
+    *rb.reg &= ~(1 << rb.bit);
+  }
+}
+
+// Registers that differ from the expected values
+static int regMismatches() {
+  int bad = 0;
+  for (int i = 0; i < (int)REGS; i++) {
+    volatile uint8_t *r = regAt(i);
+    if (r && (*r != expected[i])) bad++;
+  }
+  return bad;
+}
+
+
+/***** Pins under test *****/
+
+static const uint8_t dioPins[8] = { DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN };
+
+// In control bit order: 0 IFC ... 7 ATN
+static const uint8_t ctrlPins[8] = { IFC_PIN, NDAC_PIN, NRFD_PIN, DAV_PIN, EOI_PIN, REN_PIN, SRQ_PIN, ATN_PIN };
+
+
+/***** Tests *****/
+
+// Pins within the core table and no two signals on the same port bit
+static void testPinMap() {
+  const int npins = sizeof(corePins) / sizeof(corePins[0]);
+  uint8_t all[16];
+  for (int i = 0; i < 8; i++) {
+    all[i] = dioPins[i];
+    all[i + 8] = ctrlPins[i];
+  }
+  for (int i = 0; i < 16; i++) {
+    CHECK(all[i] < npins);
+    if (all[i] >= npins) return;
+  }
+  for (int i = 0; i < 16; i++) {
+    for (int j = i + 1; j < 16; j++) {
+      CHECK((corePins[all[i]].port != corePins[all[j]].port) || (corePins[all[i]].bit != corePins[all[j]].bit));
+    }
+  }
+}
+
+
+// Every byte written onto its data pins (active low) as outputs
+static void testSetDbus() {
+  for (int v = 0; v < 256; v++) {
+    scramble();
+    for (int i = 0; i < 8; i++) {
+      expectBit(dirBit(dioPins[i]), true);
+      expectBit(outBit(dioPins[i]), !((v >> i) & 1));
+    }
+    setGpibDbus(v);
+    const int bad = regMismatches();
+    CHECK(bad == 0);
+    if (bad) {
+      printf("  byte 0x%02X\n", v);
+      return;
+    }
+  }
+}
+
+
+// Every byte read back from its data pins, whatever the other input bits
+static void testReadDbus() {
+  for (int v = 0; v < 256; v++) {
+    scramble();
+    for (int i = 0; i < 8; i++) setBit(inBit(dioPins[i]), !((v >> i) & 1));
+    const uint8_t db = readGpibDbus();
+    CHECK(db == v);
+    if (db != v) {
+      printf("  byte 0x%02X read as 0x%02X\n", v, db);
+      return;
+    }
+  }
+}
+
+
+// Data pins turned into inputs with pull-ups
+static void testReadyDbus() {
+  for (int n = 0; n < 64; n++) {
+    scramble();
+    for (int i = 0; i < 8; i++) {
+      expectBit(dirBit(dioPins[i]), false);
+      expectBit(pullBit(dioPins[i]), true);
+    }
+    readyGpibDbus();
+    CHECK(regMismatches() == 0);
+  }
+}
+
+
+// Every masked control bit on its pin, unmasked ones untouched
+static void testCtrlState() {
+  for (int mask = 0; mask < 256; mask++) {
+    for (int bits = 0; bits < 256; bits++) {
+      scramble();
+      for (int i = 0; i < 8; i++) {
+        if ((mask >> i) & 1) expectBit(outBit(ctrlPins[i]), (bits >> i) & 1);
+      }
+      setGpibCtrlState(bits, mask);
+      const int bad = regMismatches();
+      CHECK(bad == 0);
+      if (bad) {
+        printf("  bits 0x%02X mask 0x%02X\n", bits, mask);
+        return;
+      }
+    }
+  }
+}
+
+
+// Every masked control bit sets the direction of its pin. An input may
+// get its pull-up, and on the 4809 an output may lose it.
+static void testCtrlDir() {
+  for (int mask = 0; mask < 256; mask++) {
+    for (int bits = 0; bits < 256; bits++) {
+      scramble();
+      setGpibCtrlDir(bits, mask);
+      for (int i = 0; i < 8; i++) {
+        if (!((mask >> i) & 1)) continue;
+        const bool output = (bits >> i) & 1;
+        expectBit(dirBit(ctrlPins[i]), output);
+#ifdef __AVR_XMEGA__
+        expectBit(pullBit(ctrlPins[i]), !output);
+#else
+        const RegBit pull = pullBit(ctrlPins[i]);
+        if (!output && ((*pull.reg >> pull.bit) & 1)) expectBit(pull, true);
+#endif
+      }
+      const int bad = regMismatches();
+      CHECK(bad == 0);
+      if (bad) {
+        printf("  bits 0x%02X mask 0x%02X\n", bits, mask);
+        return;
+      }
+    }
+  }
+}
+
+
+// Control pin states read through the core pin numbers
+static void testPinState() {
+  for (int i = 0; i < 8; i++) {
+    scramble();
+    setBit(inBit(ctrlPins[i]), false);
+    CHECK(getGpibPinState(ctrlPins[i]) == 0);
+    setBit(inBit(ctrlPins[i]), true);
+    CHECK(getGpibPinState(ctrlPins[i]) == 1);
+  }
+}
+
+
+struct TestCase {
+  const char *name;
+  void (*fn)();
+};
+
+static const TestCase tests[] = {
+  { "pin map",                  testPinMap },
+  { "data bus write, 256 bytes", testSetDbus },
+  { "data bus read, 256 bytes",  testReadDbus },
+  { "data bus ready",           testReadyDbus },
+  { "control state, all masks", testCtrlState },
+  { "control direction, all masks", testCtrlDir },
+  { "control pin state",        testPinState },
+};
+
+
+int main() {
+  int failed = 0;
+
+  for (const TestCase &t : tests) {
+    const int before = failures;
+    t.fn();
+    if (failures == before) {
+      printf("PASS  %s\n", t.name);
+    }else{
+      printf("FAIL  %s\n", t.name);
+      failed++;
+    }
+  }
+  printf("%d of %d %s layout tests failed\n", failed, (int)(sizeof(tests) / sizeof(tests[0])), LAYOUT_NAME);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <Arduino.h>
+#include "AR488_Config.h"
+#include "AR488_Layouts.h"
+#include <hardware/pio.h>
+#include <hardware/dma.h>
+#include <hardware/clocks.h>
+
+/***** pio_test.cpp - PIO source and acceptor handshakes on the emulator *****/
+/*
+ * AR488_Pio.cpp is built twice: chipA drives the bus as controller
+ * (source) and chipB listens as a second board (acceptor). Tests that
+ * need an instrument with particular timing use the bus listener peer
+ * instead of chipB.
+ */
+
+#undef EMU_CHIP
+#define EMU_CHIP 0
+namespace chipA {
+#include "AR488_Pio.cpp"
+}
+
+#undef AR488_PIO_H
+#undef EMU_CHIP
+#define EMU_CHIP 1
+namespace chipB {
+#include "AR488_Pio.cpp"
+}
+
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    failures++; \
+  } \
+} while (0)
+
+
+static const uint8_t dioPins[8] = { DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN };
+
+// Byte on the data lines (active low), read pin by pin
+static uint8_t busByte() {
+  uint8_t db = 0;
+  for (uint8_t i = 0; i < 8; i++) {
+    if (!emuLine(dioPins[i])) db |= (1 << i);
+  }
+  return db;
+}
+
+
+/***** Received bytes *****/
+#define RXMAX 512
+
+struct RxLog {
+  uint8_t data[RXMAX];
+  bool eoi[RXMAX];
+  int count;
+
+  void clear() { count = 0; }
+  void add(uint8_t db, bool e) {
+    if (count < RXMAX) {
+      data[count] = db;
+      eoi[count] = e;
+    }
+    count++;
+  }
+};
+
+static RxLog rx;
+
+
+/***** Bus listener peer *****/
+/*
+ * An instrument as acceptor: waits 'delay' cycles before raising NRFD and
+ * before accepting each byte. After 'stopAfter' bytes it releases NDAC
+ * and stops taking part, leaving NDAC stuck high.
+ */
+enum listenerPhase { L_NOT_READY, L_READY, L_ACCEPT, L_DAV_WAIT, L_STUCK };
+
+struct Listener {
+  uint64_t delay;
+  int stopAfter;
+  listenerPhase phase;
+  uint64_t due;
+  uint16_t lastBus;
+  uint64_t lastChange;
+  uint64_t minSettle;
+  uint32_t davCount;
+  bool davWasLow;
+};
+
+static Listener lsn;
+
+static void listenerPeer() {
+  const uint64_t now = emuCycles();
+  const uint16_t bus = busByte() | (emuLine(EOI_PIN) ? 0 : 0x100);
+
+  if (bus != lsn.lastBus) {
+    lsn.lastBus = bus;
+    lsn.lastChange = now;
+  }
+  if (!emuLine(DAV_PIN) && !lsn.davWasLow) lsn.davCount++;
+  lsn.davWasLow = !emuLine(DAV_PIN);
+
+  switch (lsn.phase) {
+    case L_NOT_READY:
+      if (now >= lsn.due) {
+        emuPeerDrive(NRFD_PIN, false);
+        lsn.phase = L_READY;
+      }
+      break;
+    case L_READY:
+      if (!emuLine(DAV_PIN)) {
+        if ((now - lsn.lastChange) < lsn.minSettle) lsn.minSettle = now - lsn.lastChange;
+        rx.add(busByte(), !emuLine(EOI_PIN));
+        emuPeerDrive(NRFD_PIN, true);
+        lsn.due = now + lsn.delay;
+        lsn.phase = L_ACCEPT;
+      }
+      break;
+    case L_ACCEPT:
+      if (now >= lsn.due) {
+        emuPeerDrive(NDAC_PIN, false);
+        lsn.phase = (rx.count == lsn.stopAfter) ? L_STUCK : L_DAV_WAIT;
+      }
+      break;
+    case L_DAV_WAIT:
+      if (emuLine(DAV_PIN)) {
+        emuPeerDrive(NDAC_PIN, true);
+        lsn.due = now + lsn.delay;
+        lsn.phase = L_NOT_READY;
+      }
+      break;
+    case L_STUCK:
+      break;
+  }
+}
+
+static void listenerStart(uint64_t delay, int stopAfter) {
+  rx.clear();
+  lsn.delay = delay;
+  lsn.stopAfter = stopAfter;
+  lsn.phase = L_NOT_READY;
+  lsn.due = emuCycles() + delay;
+  lsn.lastBus = 0xFFFF;
+  lsn.lastChange = emuCycles();
+  lsn.minSettle = UINT64_MAX;
+  lsn.davCount = 0;
+  lsn.davWasLow = false;
+  emuPeerDrive(NDAC_PIN, true);
+  emuPeerDrive(NRFD_PIN, true);
+  emuSetPeer(listenerPeer);
+}
+
+
+/***** chipB acceptor drained every cycle *****/
+static void acceptorPeer() {
+  uint8_t db;
+  bool eoi;
+  while (chipB::pioAcceptByte(&db, &eoi)) rx.add(db, eoi);
+}
+
+
+static void peerStop() {
+  emuSetPeer(nullptr);
+  emuPeerRelease();
+}
+
+
+static uint8_t pattern(int i) {
+  return (uint8_t)(i * 37 + 11);
+}
+
+
+// Queue n pattern bytes, EOI on the last. False on the first queue timeout.
+static bool queuePattern(int n, unsigned long tmo) {
+  for (int i = 0; i < n; i++) {
+    if (!chipA::pioSourceQueueWait(pattern(i), (i == n - 1), tmo)) return false;
+  }
+  return true;
+}
+
+
+// Received bytes that differ from the pattern (and EOI on the last if checkEoi)
+static int rxMismatches(int n, bool checkEoi) {
+  int bad = 0;
+  for (int i = 0; (i < n) && (i < rx.count); i++) {
+    if (rx.data[i] != pattern(i)) bad++;
+    if (checkEoi && (rx.eoi[i] != (i == n - 1))) bad++;
+  }
+  return bad;
+}
+
+
+static bool pinsReleased() {
+  const uint8_t pins[] = { DIO1_PIN, DIO2_PIN, DIO3_PIN, DIO4_PIN, DIO5_PIN, DIO6_PIN, DIO7_PIN, DIO8_PIN,
+                           EOI_PIN, DAV_PIN, NRFD_PIN, NDAC_PIN };
+  for (uint8_t p : pins) {
+    if (emuPinFunction(0, p) != GPIO_FUNC_SIO) return false;
+    if (emuPinFunction(1, p) != GPIO_FUNC_SIO) return false;
+  }
+  return true;
+}
+
+
+/***** Tests *****/
+
+// More than two DMA buffers from the source into the acceptor of a second board
+static void testSourceToAcceptor(bool freeRun) {
+  const int n = 3 * PIO_TXBUF_SIZE + 7;
+
+  rx.clear();
+  chipB::pioAcceptStart(freeRun);
+  chipA::pioSourceStart(1);
+  emuSetPeer(acceptorPeer);
+
+  CHECK(queuePattern(n, 5));
+  CHECK(chipA::pioSourceFlush(5));
+  CHECK(chipA::pioSourceIdle());
+  emuRun(1000);
+
+  chipA::pioSourceStop();
+  chipB::pioAcceptStop();
+  peerStop();
+
+  CHECK(rx.count == n);
+  CHECK(rxMismatches(n, true) == 0);
+  CHECK(pinsReleased());
+}
+
+
+// Listener much slower than the timeout per transfer but not per byte
+static void testSlowListener() {
+  const int n = 2 * PIO_TXBUF_SIZE + 20;
+  const unsigned long tmo = 2;
+  const uint64_t delay = EMU_CLK_HZ / 1000 / 3;   // 1/3 ms per handshake step
+
+  chipA::pioSourceStart(1);
+  listenerStart(delay, -1);
+  const unsigned long start = millis();
+
+  CHECK(queuePattern(n, tmo));
+  CHECK(chipA::pioSourceFlush(tmo));
+  const unsigned long elapsed = millis() - start;
+
+  chipA::pioSourceStop();
+  peerStop();
+
+  // The whole transfer takes far longer than one timeout
+  CHECK(elapsed > 20 * tmo);
+  CHECK(rx.count == n);
+  CHECK(rxMismatches(n, false) == 0);
+}
+
+
+// No listener: NDAC stays high, nothing moves and the flush times out
+static void testNdacStuckHigh() {
+  const unsigned long tmo = 2;
+
+  rx.clear();
+  lsn.davCount = 0;
+  lsn.davWasLow = false;
+  chipA::pioSourceStart(1);
+  emuSetPeer([]() { if (!emuLine(DAV_PIN)) lsn.davCount++; });
+
+  CHECK(queuePattern(3, tmo));
+  const unsigned long start = millis();
+  CHECK(!chipA::pioSourceFlush(tmo));
+  const unsigned long elapsed = millis() - start;
+  CHECK(elapsed >= tmo);
+  CHECK(elapsed <= tmo + 1);
+  CHECK(lsn.davCount == 0);
+  CHECK(!chipA::pioSourceIdle());
+
+  chipA::pioSourceStop();
+  peerStop();
+  CHECK(emuLine(DAV_PIN));
+}
+
+
+// Listener stops after a few bytes: queueing and flushing time out, no byte lost before that
+static void testNdacStuckAfterBytes() {
+  const unsigned long tmo = 2;
+  const int stopAfter = 5;
+
+  chipA::pioSourceStart(1);
+  listenerStart(100, stopAfter);
+
+  // Both buffers and the FIFO fill up, then the queue stops moving
+  CHECK(!queuePattern(4 * PIO_TXBUF_SIZE, tmo));
+  CHECK(!chipA::pioSourceFlush(tmo));
+
+  chipA::pioSourceStop();
+  peerStop();
+
+  CHECK(rx.count == stopAfter);
+  CHECK(rxMismatches(stopAfter, false) == 0);
+}
+
+
+// EOI only with the last byte, data lines and settling time as queued
+static void testEoiOnLastByte() {
+  const uint8_t msg[] = { 0x00, 0xFF, 0x55, 0xAA, 0x81, 0x7E };
+  const int n = sizeof(msg);
+  const uint16_t settleUs = 2;
+
+  chipA::pioSourceStart(settleUs);
+  listenerStart(50, -1);
+
+  for (int i = 0; i < n; i++) CHECK(chipA::pioSourceQueueWait(msg[i], (i == n - 1), 5));
+  CHECK(chipA::pioSourceFlush(5));
+  emuRun(1000);
+
+  CHECK(rx.count == n);
+  for (int i = 0; (i < n) && (i < rx.count); i++) {
+    CHECK(rx.data[i] == msg[i]);
+    CHECK(rx.eoi[i] == (i == n - 1));
+  }
+  CHECK(lsn.minSettle >= (uint64_t)settleUs * EMU_CLK_HZ / 1000000);
+
+  // And no EOI at all when not requested
+  listenerStart(50, -1);
+  for (int i = 0; i < n; i++) CHECK(chipA::pioSourceQueueWait(msg[i], false, 5));
+  CHECK(chipA::pioSourceFlush(5));
+  CHECK(rx.count == n);
+  for (int i = 0; (i < n) && (i < rx.count); i++) CHECK(!rx.eoi[i]);
+
+  // EOI and data released when the source stops
+  chipA::pioSourceStop();
+  peerStop();
+  CHECK(emuLine(EOI_PIN));
+  CHECK(busByte() == 0);
+}
+
+
+struct TestCase {
+  const char *name;
+  void (*fn)();
+};
+
+static const TestCase tests[] = {
+  { "source to acceptor, free running",  []() { testSourceToAcceptor(true); } },
+  { "source to acceptor, one permit",    []() { testSourceToAcceptor(false); } },
+  { "slow listener",                     testSlowListener },
+  { "NDAC stuck high, no listener",      testNdacStuckHigh },
+  { "NDAC stuck high after 5 bytes",     testNdacStuckAfterBytes },
+  { "EOI on the last byte",              testEoiOnLastByte },
+};
+
+
+int main() {
+  int failed = 0;
+
+  for (const TestCase &t : tests) {
+    const int before = failures;
+    t.fn();
+    if (failures == before) {
+      printf("PASS  %s\n", t.name);
+    }else{
+      printf("FAIL  %s\n", t.name);
+      failed++;
+    }
+  }
+  printf("%d of %d PIO tests failed\n", failed, (int)(sizeof(tests) / sizeof(tests[0])));
+  return failed ? 1 : 0;
+}
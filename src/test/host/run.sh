@@ -0,0 +1,28 @@
+#!/bin/sh
+# Build and run the host tests. Needs only a host C++ compiler.
+#   sh src/test/host/run.sh
+set -e
+cd "$(dirname "$0")"
+CXX=${CXX:-g++}
+OUT=${OUT:-${TMPDIR:-/tmp}/ar488-host-tests}
+FLAGS="-std=gnu++11 -Wall -O2 -Iemu -I../../AR488 -DARDUINO_USB_CDC_ON_BOOT=1"
+mkdir -p "$OUT"
+
+# PIO source/acceptor on the RAS_PICO_L1 pins
+$CXX $FLAGS -DARDUINO_ARCH_RP2040 -DPICO_PIO_HANDSHAKE pio_test.cpp emu/pico_emu.cpp -o "$OUT/pio_test"
+"$OUT/pio_test"
+
+# Dual core receive ring, two threads
+$CXX $FLAGS -pthread -DARDUINO_ARCH_RP2040 -DPICO_DUAL_CORE spsc_test.cpp -o "$OUT/spsc_test"
+"$OUT/spsc_test"
+
+# Hand-written AVR port code of each layout against its pin numbers
+for t in __AVR_ATmega328P__:AR488_UNO __AVR_ATmega328P__:AR488_NANO __AVR_ATmega328PB__:AR488_328PB_ALT \
+         __AVR_ATmega32U4__:AR488_MEGA32U4_MICRO __AVR_ATmega32U4__:AR488_MEGA32U4_LR3 \
+         __AVR_ATmega2560__:AR488_MEGA2560_D __AVR_ATmega2560__:AR488_MEGA2560_E1 __AVR_ATmega2560__:AR488_MEGA2560_E2 \
+         __AVR_ATmega644P__:AR488_MEGA644P_MCGRAW "__AVR_ATmega4809__ -D__AVR_XMEGA__:POE_ETHERNET_GPIB_ADAPTOR"; do
+  mcu=${t%:*}
+  layout=${t#*:}
+  $CXX $FLAGS -D__AVR__ -D$mcu -DTEST_$layout layout_test.cpp -o "$OUT/layout_test_$layout"
+  "$OUT/layout_test_$layout"
+done
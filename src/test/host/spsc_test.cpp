@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <thread>
+#include <Arduino.h>
+#include "AR488_Config.h"
+
+/***** spsc_test.cpp - dual core receive ring with a producer and a consumer thread *****/
+/*
+ * Only the ring is built: GPIBbus is kept out by its include guard and
+ * the one type AR488_DualCore.h needs from it. The producer waits on a
+ * full ring the way RINGSTREAM::write() does on core 1.
+ */
+#define AR488_GPIBbus_H
+enum receiveState: uint8_t { RECEIVE_INIT };
+#include "AR488_DualCore.h"
+
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    failures++; \
+  } \
+} while (0)
+
+
+typedef SPSCRING<DUALCORE_RING_SIZE> Ring;
+
+static uint8_t pattern(uint32_t i) {
+  return (uint8_t)(i ^ (i >> 8) ^ (i >> 16));
+}
+
+
+/***** Tests *****/
+
+// Holds exactly DUALCORE_RING_SIZE bytes, FIFO order
+static void testCapacity() {
+  static Ring ring;
+  uint8_t db = 0;
+
+  for (uint32_t i = 0; i < DUALCORE_RING_SIZE; i++) CHECK(ring.push(pattern(i)));
+  CHECK(!ring.push(0));
+  CHECK(ring.available() == DUALCORE_RING_SIZE);
+  for (uint32_t i = 0; i < DUALCORE_RING_SIZE; i++) {
+    CHECK(ring.pop(db));
+    CHECK(db == pattern(i));
+  }
+  CHECK(!ring.pop(db));
+  CHECK(ring.available() == 0);
+}
+
+
+// 16-bit indices wrap around with data in the ring
+static void testIndexWrap() {
+  static Ring ring;
+  uint8_t db = 0;
+  uint32_t in = 0;
+  uint32_t out = 0;
+  int bad = 0;
+
+  while (out < 3 * 65536UL + 100) {
+    while (ring.push(pattern(in))) in++;
+    for (int k = 0; k < 300 && ring.pop(db); k++) {
+      if (db != pattern(out)) bad++;
+      out++;
+    }
+  }
+  CHECK(bad == 0);
+  CHECK(ring.available() == (uint16_t)(in - out));
+}
+
+
+// Producer thread pushes (core 1 side), consumer pops (core 0 side)
+static void testTwoThreads() {
+  static Ring ring;
+  const uint32_t total = 5000000UL;
+  uint32_t bad = 0;
+  uint32_t got = 0;
+
+  std::thread producer([&]() {
+    for (uint32_t i = 0; i < total; i++) {
+      while (!ring.push(pattern(i))) std::this_thread::yield();
+    }
+  });
+
+  uint8_t db = 0;
+  while (got < total) {
+    if (ring.pop(db)) {
+      if (db != pattern(got)) bad++;
+      got++;
+    }else{
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+
+  CHECK(bad == 0);
+  CHECK(got == total);
+  CHECK(!ring.pop(db));
+}
+
+
+struct TestCase {
+  const char *name;
+  void (*fn)();
+};
+
+static const TestCase tests[] = {
+  { "capacity and order",         testCapacity },
+  { "index wrap",                 testIndexWrap },
+  { "two threads, 5M bytes",      testTwoThreads },
+};
+
+
+int main() {
+  int failed = 0;
+
+  for (const TestCase &t : tests) {
+    const int before = failures;
+    t.fn();
+    if (failures == before) {
+      printf("PASS  %s\n", t.name);
+    }else{
+      printf("FAIL  %s\n", t.name);
+      failed++;
+    }
+  }
+  printf("%d of %d ring tests failed\n", failed, (int)(sizeof(tests) / sizeof(tests[0])));
+  return failed ? 1 : 0;
+}